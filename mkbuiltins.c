@@ -0,0 +1,106 @@
+// Generates builtins.h from builtins.def: a table of the builtins laid
+// out by a perfect hash of their names, so looking one up takes a single
+// hash and a single strcmp.
+//
+// Usage: mkbuiltins < builtins.def > builtins.h
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define MAX_BUILTINS 256
+
+char* names[MAX_BUILTINS];
+char* funcs[MAX_BUILTINS];
+bool pure[MAX_BUILTINS];
+int count;
+
+// FNV-1a, started from a seed. The same function is written into the
+// header, so the two always agree.
+unsigned int hash(unsigned int seed, const char* s) {
+	unsigned int h = 2166136261u ^ seed;
+	for (; *s; s++) {
+		h ^= (unsigned char) *s;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Print s as the inside of a C string literal
+void print_escaped(const char* s) {
+	for (; *s; s++) {
+		if (*s == '\\' || *s == '"') { putchar('\\'); }
+		putchar(*s);
+	}
+}
+
+bool perfect(unsigned int seed, int slots) {
+	bool* used = calloc(slots, sizeof(bool));
+	bool ok = true;
+	for (int i = 0; i < count && ok; i++) {
+		int slot = hash(seed, names[i]) & (slots - 1);
+		ok = !used[slot];
+		used[slot] = true;
+	}
+	free(used);
+	return ok;
+}
+
+int main(void) {
+
+	char line[256];
+	while (fgets(line, sizeof(line), stdin)) {
+		char name[128];
+		char func[128];
+		char flag[128];
+		int fields = sscanf(line, "%127s %127s %127s", name, func, flag);
+		if (line[0] == '#' || fields < 2) { continue; }
+		if (count == MAX_BUILTINS) {
+			fprintf(stderr, "mkbuiltins: more than %d builtins\n", MAX_BUILTINS);
+			return 1;
+		}
+		names[count] = strdup(name);
+		funcs[count] = strdup(func);
+		pure[count] = fields == 3 && strcmp(flag, "pure") == 0;
+		count++;
+	}
+
+	// Start with a table at least twice the size, which a few thousand
+	// seeds nearly always fit; double it if they do not
+	int slots = 1;
+	while (slots < 2 * count) { slots *= 2; }
+	unsigned int seed = 0;
+	while (!perfect(seed, slots)) {
+		if (++seed == 100000) {
+			seed = 0;
+			slots *= 2;
+		}
+	}
+
+	printf("// Generated by mkbuiltins from builtins.def; do not edit\n\n");
+	printf("#define LBUILTIN_COUNT %d\n", count);
+	printf("#define LBUILTIN_SLOTS %d\n\n", slots);
+
+	printf("unsigned int lbuiltin_hash(const char* s) {\n");
+	printf("\tunsigned int h = 2166136261u ^ %uu;\n", seed);
+	printf("\tfor (; *s; s++) {\n");
+	printf("\t\th ^= (unsigned char) *s;\n");
+	printf("\t\th *= 16777619u;\n");
+	printf("\t}\n");
+	printf("\treturn h & (LBUILTIN_SLOTS - 1);\n");
+	printf("}\n\n");
+
+	printf("lbuiltin_entry lbuiltin_table[LBUILTIN_SLOTS] = {\n");
+	for (int i = 0; i < count; i++) {
+		int slot = hash(seed, names[i]) & (slots - 1);
+		printf("\t[%d] = { \"", slot);
+		print_escaped(names[i]);
+		printf("\", %s, %s, \"%s\" },\n", funcs[i], pure[i] ? "true" : "false", funcs[i]);
+	}
+	printf("};\n");
+
+	return 0;
+}
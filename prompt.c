@@ -1,547 +1,7674 @@
+#define _POSIX_C_SOURCE 200809L
+// For MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The JIT emits x86-64 code into pages it maps itself, see "JIT"
+#if defined(__x86_64__) && defined(__unix__)
+#define LJIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include <editline/readline.h>
 
 #include "mpc.h"
 
 #define LASSERT(args, cond, err) \
-  if (!(cond)) { lval_del(args); return lval_err(err); }
+  if (!(cond)) { return lval_err(err); }
 
-#define LASSERTARGS(args, num_args, func) \
+#define LASSERTARGS(count, num_args, func) \
 	char tmp_args_buffer [200]; \
-	sprintf(tmp_args_buffer, "Function '%s' passed %i arguments; expected %i", func, args->count, num_args); \
-	LASSERT(args, args->count == num_args, tmp_args_buffer)
+	sprintf(tmp_args_buffer, "Function '%s' passed %i arguments; expected %i", func, count, num_args); \
+	LASSERT(args, count == num_args, tmp_args_buffer)
 
 // Lisp value (lval) types
-enum { LVAL_INT, LVAL_FLOAT, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_ERR };
+enum { LVAL_INT, LVAL_FLOAT, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_ERR, LVAL_BUILTIN,
+       LVAL_I64VEC, LVAL_F64VEC, LVAL_LAMBDA, LVAL_LOCAL, LVAL_FUTURE, LVAL_CHAN };
+
+// Cells of a lambda, which is laid out as a list: its formals and body as
+// written, the body with its variables resolved, the names of the
+// variables it captured and then their values. See lval_lambda.
+enum { LLAMBDA_FORMALS, LLAMBDA_BODY, LLAMBDA_CODE, LLAMBDA_CAPTURED, LLAMBDA_CAPTURES };
 
 // Error types
 enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
 
+// Lisp value flags, sharing the byte with the collector's. Builtins
+// that have quickened forms are marked, as are the quickened forms, and
+// the nodes hash-consing shares.
+enum { LVAL_INTERNED = 1, LVAL_QUICKENS = 32, LVAL_QUICK = 64, LVAL_HASHED = 128 };
+
+// Collector flags, kept on both lvals and cell blocks
+enum { LGC_YOUNG = 2, LGC_LARGE = 4, LGC_FORWARDED = 8, LGC_REMEMBERED = 16 };
+
+// Arithmetic operators, see larith
+enum { LARITH_ADD, LARITH_SUB, LARITH_MUL, LARITH_DIV, LARITH_MOD, LARITH_MAX, LARITH_MIN,
+       LARITH_POW };
+
 // Defines possible return values for a lisp value
+//
+// An "lval*" is a tagged word rather than always a pointer. Numbers are
+// NaN-boxed into the word itself so they never touch the allocator:
+//
+//   0x0000 xxxx xxxx xxxx   heap pointer to a struct lval (or NULL)
+//   0x0002 .... 0xFFF2 ...  double, stored as its bits + LVAL_DOUBLE_OFFSET
+//   0xFFFE / 0xFFFF ...     fixnum, 49-bit two's complement payload
+//
+// Integers that do not fit a fixnum fall back to a heap LVAL_INT. Always
+// go through lval_type() and the lval_get_* accessors, never v->type on a
+// value that might be a number.
+//
+// Heap lvals are 24 bytes plus trailing storage. Only one payload is live
+// for a given type, so they share a union. Symbol and error strings are
+// stored right after the struct, as are the elements of vectors, and small
+// lists keep their cells there too; either way the pointer in the union
+// points at the data so readers never need to check.
+//
+// Heap lvals are garbage collected, see "lval memory" below. Nothing is
+// ever freed by hand, so values are shared freely and are not changed
+// once anything else could be holding them: builtins only change the
+// argument list they are passed and list headers they have just made.
 typedef struct lval lval;
+
+// Builtin functions take their arguments as an array
+typedef lval* (*lbuiltin)(lval** args, int n);
+
+typedef struct {
+	char* name;
+	lbuiltin fn;
+	bool pure;
+	// The name of fn, for code compiled ahead of time to call it by
+	char* func;
+} lbuiltin_entry;
+
+// Cell storage for lists that outgrow their inline cells. A block can be
+// shared by any number of lists, each a view of some run of its slots:
+// tail is just a view that starts one slot later. The elements are in
+// slot[start..end); everything outside that range is free, so a view
+// that ends at "end" can be extended in place without the other views
+// seeing it, and likewise at "start".
+typedef struct lcells lcells;
+struct lcells {
+	unsigned char flags;
+	int start;
+	int end;
+	int cap;
+	union {
+		// Young blocks: where a minor collection copied the block to
+		lcells* forward;
+		// Old blocks in the remembered set: the slots written since the
+		// last minor collection
+		struct { int dirty_from; int dirty_to; };
+	};
+	lval* slot[];
+};
+
 struct lval {
-	int type;
-	long i;
-	double f;
-	// Error and Symbol types have some string data
-	char* err;
-	char* sym;
-	// Count and pointer to a list of "lval*"
+	unsigned char type;
+	unsigned char flags;
+	// Number of cells that fit in the storage after the struct
+	unsigned short inline_cap;
+	union {
+		// Count of "lval*" in cell, or of elements in a vector
+		int count;
+		// Symbols: interning order
+		int id;
+		// Locals: the slot of the running lambda they refer to
+		int slot;
+	};
+	union {
+		// Only used by integers too wide to be a fixnum
+		long i;
+		// Error and Symbol types have some string data, and locals the
+		// name of the symbol they were resolved from
+		char* err;
+		char* sym;
+		// Builtins: the name they are called by
+		char* name;
+		struct lval** cell;
+		// Vectors: their elements
+		long* i64;
+		double* f64;
+		// Where a minor collection copied the lval to
+		struct lval* forward;
+	};
+	union {
+		// Lists: the block cell points into, or NULL for inline cells
+		lcells* cells;
+		lbuiltin fn;
+	};
+};
+
+// Lists up to this long are allocated in one block with their cells
+#define LVAL_INLINE_MAX 6
+
+// Growable array of lvals kept outside the heap, such as the VM's value
+// stack. lgc_root_stack makes every item in it a root.
+typedef struct {
+	lval** items;
 	int count;
-	struct lval** cell;
+	int cap;
+} lval_stack;
+
+#define LVAL_DOUBLE_OFFSET 0x0002000000000000ULL
+#define LVAL_FIXNUM_TAG    0xFFFE000000000000ULL
+#define LVAL_FIXNUM_MAX    ((1L << 48) - 1)
+#define LVAL_FIXNUM_MIN    (-(1L << 48))
+
+// lval memory
+//
+// Values are garbage collected. Every lval and cell block starts out in
+// the nursery, a list of chunks that allocation just bumps a pointer
+// through. A minor collection copies whatever is still reachable out of
+// the nursery into the old generation and then reuses the chunks, so the
+// temporaries made while evaluating cost nothing to free. The old
+// generation hands out size classes from 64K slabs, each with a bitmap
+// of the slots in use and a bitmap of marks. Anything bigger than the
+// largest class is malloc'd on its own and kept on a list, young or old;
+// it is promoted by moving it to the old list, so huge cell blocks are
+// never copied.
+//
+// The old generation is collected by mark and sweep, done in slices so
+// no single pause has to walk the whole heap. See "Garbage collector".
+
+#define LMEM_CLASSES     8
+#define LMEM_MIN_CLASS   16
+#define LMEM_MAX_CLASS   (LMEM_MIN_CLASS << (LMEM_CLASSES - 1))
+#define LMEM_SLAB_SIZE   (64 * 1024)
+#define LMEM_SLAB_SLOTS  (LMEM_SLAB_SIZE / LMEM_MIN_CLASS)
+#define LMEM_CHUNK_SIZE  (256 * 1024)
+// Bytes of dead young big objects kept to be reused, see lmem_nursery_reset
+#define LMEM_SPARE_LARGE (256 * 1024)
+
+typedef struct lmem_block lmem_block;
+struct lmem_block {
+	lmem_block* next;
 };
 
-lval* lval_int(int x) {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_INT;
-	v->i = x;
+typedef struct lmem_chunk lmem_chunk;
+struct lmem_chunk {
+	lmem_chunk* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+// Slabs are aligned to their size, so the slab holding an object is
+// found by masking its address
+typedef struct lmem_slab lmem_slab;
+struct lmem_slab {
+	int class_size;
+	int slots;
+	unsigned char used[LMEM_SLAB_SLOTS / 8];
+	unsigned char mark[LMEM_SLAB_SLOTS / 8];
+	char data[];
+};
+
+// Header in front of each object too big for a size class
+typedef struct lmem_large lmem_large;
+struct lmem_large {
+	lmem_large* next;
+	size_t size;
+	// Bytes it has room for, at least size once it is reused
+	size_t cap;
+	bool young;
+	bool mark;
+};
+
+__thread struct {
+	// Nursery, newest chunk first
+	lmem_chunk* chunks;
+	lmem_chunk* spare;
+	size_t nursery_bytes;
+	// Bytes allocated since the last slice of collector work
+	size_t slice_bytes;
+	
+	// Old generation
+	lmem_block* free[LMEM_CLASSES];
+	lmem_slab** slabs;
+	int slab_count;
+	int slab_cap;
+	lmem_large* large;
+	size_t old_bytes;
+	
+	// Big objects allocated since the last minor collection
+	lmem_large* young_large;
+	// Dead ones kept for reuse
+	lmem_large* spare_large;
+	size_t spare_large_bytes;
+	
+	// Counters for the current line
+	long nursery_allocs;
+	long line_nursery_bytes;
+	long promoted_bytes;
+	long mallocs;
+} lmem;
+
+enum { LGC_IDLE, LGC_MARK, LGC_SWEEP };
+
+// Growable stack of pointers. Entries that point at an lcells rather than
+// an lval have the low bit set.
+typedef struct {
+	uintptr_t* items;
+	int count;
+	int cap;
+} lgc_stack;
+
+#define LGC_CELLS 1
+
+#define LGC_PAUSES 1024
+
+__thread struct {
+	int phase;
+	// Old generation size that starts the next major collection
+	size_t threshold;
+	// Next slab to sweep, then the link to the next big object
+	int sweep_next;
+	lmem_large** sweep_large;
+	
+	// Addresses of the lval* variables that hold roots
+	lgc_stack roots;
+	// lval_stacks whose items are all roots
+	lgc_stack stacks;
+	// Old objects written since the last minor collection
+	lgc_stack remembered;
+	// Copied objects whose children still need copying
+	lgc_stack work;
+	// Marked objects whose children still need marking
+	lgc_stack gray;
+	// Big blocks are marked a slice at a time; this is the one under way
+	lcells* scan_cells;
+	int scan_next;
+	
+	long minors;
+	long majors;
+	// The most recent pause times in ms, as a ring
+	double pauses[LGC_PAUSES];
+	long pause_count;
+	
+	// For the current line
+	long line_minors;
+	double line_pause_max;
+	
+	// Collect at every safepoint, to shake out unrooted lvals
+	bool stress;
+} lgc;
+
+// Bytecode
+//
+// Each line is compiled before it runs. Code is a flat array of ints,
+// an opcode followed by its operands:
+//
+//   LOP_CONST k n    push constants k to k+n-1
+//   LOP_GLOBAL k c   push the value of the symbol in constant k, looked
+//                    up through the chunk's cache c
+//   LOP_LOCAL i      push slot i of the running lambda, see lval_lambda
+//   LOP_ERROR k      stop, with the error in constant k as the result
+//   LOP_CALL k n     call the builtin that the S-expression in constant
+//                    k starts with on the top n values, replacing them
+//                    with its result
+//   LOP_APPLY n      evaluate a list of the top n values, as
+//                    lval_eval_sexpr does once it has evaluated them
+//   LOP_EVAL         evaluate the Q-expression on top of the stack,
+//                    replacing it with the result
+//   LOP_LAMBDA       make a lambda of the top two values, formals and
+//                    body, inside the running lambda
+//   LOP_JIT j n      push the result of the chunk's JIT site j and skip
+//                    the n words after, which compute the same value, if
+//                    the site has native code and its guards hold
+//   LOP_MEMO k n     push the value memoized for the S-expression in
+//                    constant k and skip the n words after, if there is
+//                    one, or else note k as pending, see "Memoization"
+//   LOP_STORE        memoize the top value for the last pending key
+//   LOP_FORK k n     fork tasks for the S-expressions in constants k to
+//                    k+n-1, see "Parallel evaluation"
+//   LOP_JOIN         push the result of the next task forked, or stop if
+//                    it is an error
+//   LOP_RETURN       stop, with the top value as the result
+//
+// A Q-expression literal is just a constant. Any error a call returns
+// stops the whole chunk, as it would stop every enclosing S-expression.
+//
+// Nested S-expressions compile to one flat chunk, but eval has to compile
+// its Q-expression when it runs. Rather than recursing into a new
+// lvm_exec, LOP_EVAL saves where the chunk was on a stack of frames and
+// starts on the new one, and LOP_RETURN carries on from the frame below.
+// An eval whose result is the chunk's result, one followed by
+// LOP_RETURN, replaces its chunk instead, so chains of them run in
+// constant space. Calling a lambda also compiles and starts its body,
+// with the lambda and its arguments left on the stack below it, and
+// likewise replaces its chunk in tail position. Frames and values live
+// on the heap, so the only limit on nesting is lvm.max_depth, see
+// --max-depth.
+enum { LOP_CONST, LOP_GLOBAL, LOP_LOCAL, LOP_ERROR, LOP_CALL, LOP_APPLY, LOP_EVAL, LOP_LAMBDA,
+       LOP_JIT, LOP_MEMO, LOP_STORE, LOP_FORK, LOP_JOIN, LOP_RETURN };
+
+// What looking a global up found, as of lenv.version, see lenv_cached
+typedef struct {
+	unsigned int version;
+	lval* value;
+} lcache;
+
+// Native code for a JIT site. It reads the site's inputs from "in" and,
+// unless a guard fails, stores the result at "out" and returns 1.
+typedef int (*ljit_fn)(lval** in, void* out);
+
+// A variable that JIT'd code reads: the global sym, or when sym is NULL
+// slot "slot" of the running lambda
+typedef struct {
+	lval* sym;
+	int slot;
+	lcache cache;
+} ljit_input;
+
+// An arithmetic S-expression the JIT compiles once it is hot, see LOP_JIT
+typedef struct {
+	// The S-expression, as a constant of the chunk
+	int expr;
+	// How often it has run, and how often its native code has given up
+	int runs;
+	int deopts;
+	ljit_fn fn;
+	bool is_float;
+	// Set once native code is no use for it
+	bool failed;
+	// Its inputs, in the chunk's
+	int input_from;
+	int input_count;
+} ljit_site;
+
+// Pages of native code
+typedef struct ljit_block ljit_block;
+struct ljit_block {
+	ljit_block* next;
+	unsigned char* code;
+	size_t size;
+	size_t used;
+};
+
+typedef struct {
+	int* code;
+	int count;
+	int cap;
+	// Where the last instruction starts, for merging LOP_CONSTs
+	int last;
+	// Constants, gathered here while compiling. Compiling never collects,
+	// so they need no rooting until lvm_exec copies them to a list.
+	lval_stack consts;
+	// Stack depth while compiling, and the most the chunk needs
+	int depth;
+	int max_depth;
+	// Caches for its LOP_GLOBALs
+	lcache* caches;
+	int cache_count;
+	int cache_cap;
+	// Sites for its LOP_JITs, their inputs, and their native code
+	ljit_site* sites;
+	int site_count;
+	int site_cap;
+	ljit_input* inputs;
+	int input_count;
+	int input_cap;
+	ljit_block* blocks;
+} lchunk;
+
+// An evaluation waiting on one inside it. For the VM that is a chunk
+// waiting on an eval, and next is the pc to carry on from; for
+// lval_eval_sexpr it is an S-expression waiting on one of its items, and
+// next is the item after that one.
+typedef struct {
+	// Where the frame's values start on the stack. The slot before holds
+	// its constants, or the S-expression.
+	int base;
+	int next;
+	// Where the arguments of the lambda it is running start on the stack,
+	// just after the lambda itself, or -1 outside any lambda
+	int locals;
+	// What the stack is cut back to once the evaluation it waits on, or
+	// for lval_eval_sexpr its own, is done
+	int top;
+	// For lval_eval_sexpr, whether its value is to be memoized
+	bool memo;
+} lframe;
+
+// A chunk kept for the body it was compiled from
+typedef struct {
+	lval* body;
+	lchunk* chunk;
+} lvm_cached;
+
+// GCC and clang can jump straight to the next opcode's code through a
+// table of label addresses, rather than back through a switch
+#if defined(__GNUC__)
+#define LVM_THREADED
+#endif
+
+// Default for --max-depth
+#define LVM_MAX_DEPTH 100000
+
+// How many chunks lvm_compile_body keeps, in a table twice the size
+#define LVM_CACHED_MAX 4096
+
+__thread struct {
+	// Values of every chunk that is running, innermost on top
+	lval_stack stack;
+	// The chunk running at each level of nested evaluation, and the one
+	// each level compiles into, kept to reuse its buffers
+	lchunk** chunks;
+	lchunk** spare;
+	int depth;
+	int cap;
+	// Chunks compiled for lambda bodies and evaluated Q-expressions, kept
+	// so they are compiled once and their sites stay hot, see
+	// lvm_compile_body. The bodies are rooted on "bodies".
+	lvm_cached* cached;
+	int cached_count;
+	lval_stack bodies;
+	// Evaluations waiting on inner ones, innermost on top
+	lframe* frames;
+	int frame_count;
+	int frame_cap;
+	// How many frames there can be before evaluation stops with an error
+	int max_depth;
+	// Evaluate with lval_eval rather than the VM, see --tree-eval
+	bool reference;
+	// Compile hot arithmetic to native code, see --jit
+	bool jit;
+	// Fork pure items onto the pool, see --parallel
+	bool parallel;
+} lvm;
+
+int lmem_class(size_t size) {
+	int c = 0;
+	size_t class_size = LMEM_MIN_CLASS;
+	while (class_size < size) { class_size <<= 1; c++; }
+	return c;
+}
+
+lmem_slab* lmem_slab_of(void* ptr) {
+	return (lmem_slab*) ((uintptr_t) ptr & ~(uintptr_t) (LMEM_SLAB_SIZE - 1));
+}
+
+int lmem_slot(lmem_slab* s, void* ptr) {
+	return ((char*) ptr - s->data) / s->class_size;
+}
+
+void lmem_slab_new(int c) {
+	void* ptr;
+	if (posix_memalign(&ptr, LMEM_SLAB_SIZE, LMEM_SLAB_SIZE) != 0) {
+		puts("Out of memory");
+		exit(1);
+	}
+	lmem.mallocs++;
+	
+	lmem_slab* s = ptr;
+	memset(s, 0, sizeof(lmem_slab));
+	s->class_size = LMEM_MIN_CLASS << c;
+	s->slots = (LMEM_SLAB_SIZE - sizeof(lmem_slab)) / s->class_size;
+	
+	// Thread the slots onto the free list so they are handed out in order
+	for (int i = s->slots - 1; i >= 0; i--) {
+		lmem_block* block = (lmem_block*) (s->data + i * s->class_size);
+		block->next = lmem.free[c];
+		lmem.free[c] = block;
+	}
+	
+	if (lmem.slab_count == lmem.slab_cap) {
+		lmem.slab_cap = lmem.slab_cap ? lmem.slab_cap * 2 : 16;
+		lmem.slabs = realloc(lmem.slabs, sizeof(lmem_slab*) * lmem.slab_cap);
+	}
+	lmem.slabs[lmem.slab_count++] = s;
+}
+
+// Allocate in the old generation. While a major collection is running
+// new objects are born marked, so the sweep leaves them alone.
+void* lmem_old_alloc(size_t size) {
+	bool mark = lgc.phase != LGC_IDLE;
+	int c = lmem_class(size);
+	if (lmem.free[c] == NULL) { lmem_slab_new(c); }
+	lmem_block* block = lmem.free[c];
+	lmem.free[c] = block->next;
+	
+	lmem_slab* s = lmem_slab_of(block);
+	int i = lmem_slot(s, block);
+	s->used[i / 8] |= 1 << i % 8;
+	if (mark) { s->mark[i / 8] |= 1 << i % 8; }
+	lmem.old_bytes += s->class_size;
+	return block;
+}
+
+void* lmem_nursery_alloc(size_t size) {
+	size = (size + 7) & ~(size_t) 7;
+	lmem_chunk* chunk = lmem.chunks;
+	
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		// Reuse the chunk kept back from the last reset
+		if (lmem.spare) {
+			chunk = lmem.spare;
+			lmem.spare = NULL;
+		} else {
+			chunk = malloc(sizeof(lmem_chunk) + LMEM_CHUNK_SIZE);
+			chunk->size = LMEM_CHUNK_SIZE;
+			lmem.mallocs++;
+		}
+		chunk->used = 0;
+		chunk->next = lmem.chunks;
+		lmem.chunks = chunk;
+	}
+	
+	void* ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	lmem.nursery_bytes += size;
+	lmem.slice_bytes += size;
+	lmem.nursery_allocs++;
+	lmem.line_nursery_bytes += size;
+	return ptr;
+}
+
+void lgc_pace(void);
+
+void* lmem_large_alloc(size_t size) {
+	// Big objects are mostly made by the reader, well away from any
+	// safepoint, so they pay for their share of collector work here
+	lmem.slice_bytes += size;
+	lgc_pace();
+	
+	// A spare one will do if it would not waste more than it holds
+	lmem_large* large = NULL;
+	for (lmem_large** link = &lmem.spare_large; *link; link = &(*link)->next) {
+		if ((*link)->cap >= size && (*link)->cap / 2 <= size) {
+			large = *link;
+			*link = large->next;
+			lmem.spare_large_bytes -= large->cap;
+			break;
+		}
+	}
+	if (large == NULL) {
+		large = malloc(sizeof(lmem_large) + size);
+		large->cap = size;
+		lmem.mallocs++;
+	}
+	large->next = lmem.young_large;
+	large->size = size;
+	large->young = true;
+	large->mark = false;
+	lmem.young_large = large;
+	lmem.nursery_bytes += size;
+	lmem.nursery_allocs++;
+	lmem.line_nursery_bytes += size;
+	return large + 1;
+}
+
+// Add big objects made by another thread, a list of them like the one
+// lmem_large_alloc makes, to the nursery
+void lmem_large_adopt(lmem_large* large) {
+	while (large) {
+		lmem_large* next = large->next;
+		large->next = lmem.young_large;
+		lmem.young_large = large;
+		lmem.nursery_bytes += large->size;
+		lmem.slice_bytes += large->size;
+		large = next;
+	}
+}
+
+// A thread running a task of a parallel evaluation allocates from an
+// arena of its own instead, see "Parallel evaluation"
+typedef struct {
+	lmem_chunk* chunks;
+	lmem_chunk* spare;
+	// For a message's arena, see liso_message_new: each object is
+	// malloc'd on its own onto "large", as a young big object, so that the
+	// isolate taking the message can adopt them into its nursery as they are
+	bool loose;
+	lmem_large* large;
+} lpar_arena;
+
+__thread lpar_arena* lpar_arena_now;
+
+void* lpar_alloc(lpar_arena* a, size_t size) {
+	if (a->loose) {
+		lmem_large* large = malloc(sizeof(lmem_large) + size);
+		*large = (lmem_large) { a->large, size, size, true, false };
+		a->large = large;
+		return large + 1;
+	}
+	size = (size + 7) & ~(size_t) 7;
+	lmem_chunk* chunk = a->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		if (a->spare && size <= LMEM_CHUNK_SIZE) {
+			chunk = a->spare;
+			a->spare = chunk->next;
+		} else {
+			size_t cap = size > LMEM_CHUNK_SIZE ? size : LMEM_CHUNK_SIZE;
+			chunk = malloc(sizeof(lmem_chunk) + cap);
+			chunk->size = cap;
+		}
+		chunk->used = 0;
+		chunk->next = a->chunks;
+		a->chunks = chunk;
+	}
+	void* ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+// Empty the arena, keeping its chunks of the usual size
+void lpar_arena_reset(lpar_arena* a) {
+	lmem_chunk* chunk = a->chunks;
+	while (chunk) {
+		lmem_chunk* next = chunk->next;
+		if (chunk->size == LMEM_CHUNK_SIZE) {
+			chunk->next = a->spare;
+			a->spare = chunk;
+		} else {
+			free(chunk);
+		}
+		chunk = next;
+	}
+	a->chunks = NULL;
+	while (a->large) {
+		lmem_large* next = a->large->next;
+		free(a->large);
+		a->large = next;
+	}
+}
+
+// Give all of the arena's chunks back to malloc
+void lpar_arena_free(lpar_arena* a) {
+	lpar_arena_reset(a);
+	while (a->spare) {
+		lmem_chunk* next = a->spare->next;
+		free(a->spare);
+		a->spare = next;
+	}
+}
+
+// Allocate a new object in the nursery, or on its own if it is too big
+// for a size class. lmem_flags gives the collector flags it starts with.
+void* lmem_alloc(size_t size) {
+	if (lpar_arena_now) { return lpar_alloc(lpar_arena_now, size); }
+	return size > LMEM_MAX_CLASS ? lmem_large_alloc(size) : lmem_nursery_alloc(size);
+}
+
+unsigned char lmem_flags(size_t size) {
+	// The collector leaves arena objects alone, as it does interned ones.
+	// A message's are made as what they become once taken.
+	if (lpar_arena_now) { return lpar_arena_now->loose ? LGC_YOUNG | LGC_LARGE : LVAL_INTERNED; }
+	return size > LMEM_MAX_CLASS ? LGC_YOUNG | LGC_LARGE : LGC_YOUNG;
+}
+
+// Move a young big object to the old generation. Like anything else
+// promoted during a major collection it is born marked.
+void lmem_large_promote(void* ptr) {
+	lmem_large* large = (lmem_large*) ptr - 1;
+	large->young = false;
+	large->mark = lgc.phase != LGC_IDLE;
+	lmem.promoted_bytes += large->size;
+}
+
+// Throw away everything in the nursery. One chunk is kept for reuse, the
+// rest go back to malloc. Big objects flagged old by lmem_large_promote
+// join the old list. The rest are kept for reuse up to LMEM_SPARE_LARGE
+// bytes and freed after that: malloc can only hand out a big block after
+// merging the small ones freed since, and the reader frees many.
+void lmem_nursery_reset(void) {
+	lmem_large* large = lmem.young_large;
+	while (large) {
+		lmem_large* next = large->next;
+		if (large->young && lmem.spare_large_bytes + large->cap <= LMEM_SPARE_LARGE) {
+			large->next = lmem.spare_large;
+			lmem.spare_large = large;
+			lmem.spare_large_bytes += large->cap;
+		} else if (large->young) {
+			free(large);
+		} else {
+			large->next = lmem.large;
+			lmem.large = large;
+			lmem.old_bytes += large->size;
+		}
+		large = next;
+	}
+	lmem.young_large = NULL;
+	
+	lmem_chunk* chunk = lmem.chunks;
+	while (chunk) {
+		lmem_chunk* next = chunk->next;
+		if (lmem.spare == NULL) {
+			lmem.spare = chunk;
+		} else {
+			free(chunk);
+		}
+		chunk = next;
+	}
+	lmem.chunks = NULL;
+	lmem.nursery_bytes = 0;
+}
+
+// Give the whole heap back to malloc, once the isolate it is for has
+// ended
+void lmem_release(void) {
+	lmem_nursery_reset();
+	free(lmem.spare);
+	lmem_large* lists[2] = { lmem.large, lmem.spare_large };
+	for (int i = 0; i < 2; i++) {
+		lmem_large* large = lists[i];
+		while (large) {
+			lmem_large* next = large->next;
+			free(large);
+			large = next;
+		}
+	}
+	for (int i = 0; i < lmem.slab_count; i++) { free(lmem.slabs[i]); }
+	free(lmem.slabs);
+}
+
+bool lmem_marked(void* ptr, int flags) {
+	if (flags & LGC_LARGE) { return ((lmem_large*) ptr - 1)->mark; }
+	lmem_slab* s = lmem_slab_of(ptr);
+	int i = lmem_slot(s, ptr);
+	return s->mark[i / 8] & (1 << i % 8);
+}
+
+void lmem_set_mark(void* ptr, int flags) {
+	if (flags & LGC_LARGE) { ((lmem_large*) ptr - 1)->mark = true; return; }
+	lmem_slab* s = lmem_slab_of(ptr);
+	int i = lmem_slot(s, ptr);
+	s->mark[i / 8] |= 1 << i % 8;
+}
+
+void lmem_clear_marks(void) {
+	for (int i = 0; i < lmem.slab_count; i++) {
+		memset(lmem.slabs[i]->mark, 0, sizeof(lmem.slabs[i]->mark));
+	}
+	for (lmem_large* large = lmem.large; large; large = large->next) {
+		large->mark = false;
+	}
+}
+
+// Free every slot in s that is in use but unmarked
+void lmem_sweep_slab(lmem_slab* s) {
+	int c = lmem_class(s->class_size);
+	for (int byte = 0; byte < (s->slots + 7) / 8; byte++) {
+		unsigned char dead = s->used[byte] & ~s->mark[byte];
+		if (dead == 0) { continue; }
+		s->used[byte] &= ~dead;
+		for (int bit = 0; bit < 8; bit++) {
+			if (!(dead & (1 << bit))) { continue; }
+			lmem_block* block = (lmem_block*) (s->data + (byte * 8 + bit) * s->class_size);
+			block->next = lmem.free[c];
+			lmem.free[c] = block;
+			lmem.old_bytes -= s->class_size;
+		}
+	}
+}
+
+// Free unmarked big objects from "link" on, until about "budget" bytes
+// have been looked at. Returns where to carry on, or NULL once done.
+lmem_large** lmem_sweep_large(lmem_large** link, size_t budget) {
+	size_t bytes = 0;
+	while (*link) {
+		if (bytes >= budget) { return link; }
+		lmem_large* large = *link;
+		bytes += large->size;
+		if (large->mark) {
+			link = &large->next;
+		} else {
+			*link = large->next;
+			lmem.old_bytes -= large->size;
+			free(large);
+		}
+	}
+	return NULL;
+}
+
+// Start counting for a new line
+void lmem_line_begin(void) {
+	lmem.nursery_allocs = 0;
+	lmem.line_nursery_bytes = 0;
+	lmem.promoted_bytes = 0;
+	lmem.mallocs = 0;
+	lgc.line_minors = 0;
+	lgc.line_pause_max = 0;
+}
+
+void lmem_print_stats(void) {
+	printf(";; %li allocations (%li bytes) in the nursery, %li bytes promoted, "
+	       "%li minor collections, %li calls to malloc, heap %zu bytes, longest pause %.3f ms\n",
+	       lmem.nursery_allocs, lmem.line_nursery_bytes, lmem.promoted_bytes,
+	       lgc.line_minors, lmem.mallocs, lmem.old_bytes, lgc.line_pause_max);
+}
+
+// Allocate an lval with "extra" bytes of trailing storage
+lval* lval_new(int type, size_t extra) {
+	size_t size = sizeof(lval) + extra;
+	lval* v = lmem_alloc(size);
+	v->type = type;
+	v->flags = lmem_flags(size);
+	v->inline_cap = 0;
+	v->count = 0;
+	v->cells = NULL;
 	return v;
 }
 
-lval* lval_float(float x) {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_FLOAT;
-	v->f = x;
+bool lval_is_young(lval* v) {
+	return v->flags & LGC_YOUNG;
+}
+
+lval** lval_inline_cells(lval* v) {
+	return (lval**) (v + 1);
+}
+
+// Size of the block holding v, as passed to lval_new
+size_t lval_size(lval* v) {
+	switch (v->type) {
+		case LVAL_ERR: return sizeof(lval) + strlen(v->err) + 1;
+		case LVAL_SYM: return sizeof(lval) + strlen(v->sym) + 1;
+		case LVAL_I64VEC: return sizeof(lval) + sizeof(long) * v->count;
+		case LVAL_F64VEC: return sizeof(lval) + sizeof(double) * v->count;
+	}
+	return sizeof(lval) + sizeof(lval*) * v->inline_cap;
+}
+
+size_t lcells_size(lcells* c) {
+	return sizeof(lcells) + sizeof(lval*) * c->cap;
+}
+
+bool lval_is_fixnum(lval* v) {
+	return ((uint64_t)(uintptr_t) v & LVAL_FIXNUM_TAG) == LVAL_FIXNUM_TAG;
+}
+
+bool lval_is_double(lval* v) {
+	return (uint64_t)(uintptr_t) v >= LVAL_DOUBLE_OFFSET && !lval_is_fixnum(v);
+}
+
+bool lval_is_immediate(lval* v) {
+	return (uint64_t)(uintptr_t) v >= LVAL_DOUBLE_OFFSET;
+}
+
+int lval_type(lval* v) {
+	if (lval_is_fixnum(v)) { return LVAL_INT; }
+	if (lval_is_double(v)) { return LVAL_FLOAT; }
+	return v->type;
+}
+
+long lval_get_int(lval* v) {
+	if (lval_is_fixnum(v)) {
+		// Shift the tag out and sign extend the 49-bit payload
+		return (long) ((int64_t) ((uint64_t)(uintptr_t) v << 15) >> 15);
+	}
+	return v->i;
+}
+
+double lval_get_float(lval* v) {
+	uint64_t bits = (uint64_t)(uintptr_t) v - LVAL_DOUBLE_OFFSET;
+	double x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+// Read any number as a double, promoting integers
+double lval_get_num(lval* v) {
+	return lval_type(v) == LVAL_FLOAT ? lval_get_float(v) : (double) lval_get_int(v);
+}
+
+lval* lval_int(long x) {
+	if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+		uint64_t bits = ((uint64_t) x & ~LVAL_FIXNUM_TAG) | LVAL_FIXNUM_TAG;
+		return (lval*)(uintptr_t) bits;
+	}
+	lval* v = lval_new(LVAL_INT, 0);
+	v->i = x;
 	return v;
 }
 
+lval* lval_float(double x) {
+	uint64_t bits;
+	// Every NaN shares one encoding so it can't collide with the fixnum tags
+	if (isnan(x)) { x = NAN; }
+	memcpy(&bits, &x, sizeof(bits));
+	return (lval*)(uintptr_t) (bits + LVAL_DOUBLE_OFFSET);
+}
+
+// Symbol table
+//
+// Symbols are interned: lval_sym returns the one lval for a given name, so
+// symbols compare by pointer or id, are never copied or freed, and cost
+// memory per distinct name rather than per occurrence. The table is open
+// addressed with linear probing and kept at most half full. It is the one
+// thing isolates share, so that a symbol in a message is the receiver's
+// symbol too.
+//
+// Looking up a symbol that is there takes no lock. A slot is filled once
+// and never emptied, and a table that fills up is replaced by one twice
+// the size rather than rehashed in place, so a reader probing either sees
+// whole symbols. Old tables are kept, as a reader may still be probing
+// one; together they are smaller than the current table. A lookup that
+// misses, perhaps only because its table was replaced, takes the lock and
+// looks again before adding the symbol.
+
+typedef struct lsym_table {
+	struct lsym_table* older;
+	int capacity;
+	lval* slots[];
+} lsym_table;
+
+struct {
+	lsym_table* table;
+	int count;
+	pthread_mutex_t lock;
+} lsyms = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+unsigned int lsym_hash(char* s) {
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	while (*s) {
+		hash ^= (unsigned char) *s++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Find the slot of t holding "s", or the empty slot where it belongs
+lval** lsym_slot(lsym_table* t, char* s) {
+	unsigned int mask = t->capacity - 1;
+	unsigned int i = lsym_hash(s) & mask;
+	lval* v;
+	while ((v = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE)) && strcmp(v->sym, s) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &t->slots[i];
+}
+
+// With the lock held
+void lsym_grow(void) {
+	lsym_table* old = lsyms.table;
+	int capacity = old ? old->capacity * 2 : 64;
+	lsym_table* t = calloc(1, sizeof(lsym_table) + sizeof(lval*) * capacity);
+	t->older = old;
+	t->capacity = capacity;
+	for (int i = 0; old && i < old->capacity; i++) {
+		if (old->slots[i]) { *lsym_slot(t, old->slots[i]->sym) = old->slots[i]; }
+	}
+	__atomic_store_n(&lsyms.table, t, __ATOMIC_RELEASE);
+}
+
 lval* lval_sym(char* s) {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_SYM;
-	v->sym = malloc(strlen(s) + 1);
-	strcpy(v->sym, s);
+	lsym_table* t = __atomic_load_n(&lsyms.table, __ATOMIC_ACQUIRE);
+	lval* v = t ? __atomic_load_n(lsym_slot(t, s), __ATOMIC_ACQUIRE) : NULL;
+	if (v) { return v; }
+	
+	pthread_mutex_lock(&lsyms.lock);
+	if (lsyms.table == NULL || 2 * (lsyms.count + 1) > lsyms.table->capacity) { lsym_grow(); }
+	
+	lval** slot = lsym_slot(lsyms.table, s);
+	v = *slot;
+	if (v == NULL) {
+		// First occurrence: symbols live for the whole session, so they
+		// are allocated outside the collected heap
+		size_t len = strlen(s);
+		v = malloc(sizeof(lval) + len + 1);
+		v->type = LVAL_SYM;
+		v->flags = LVAL_INTERNED;
+		v->inline_cap = 0;
+		v->cells = NULL;
+		v->id = lsyms.count++;
+		v->sym = (char*) (v + 1);
+		memcpy(v->sym, s, len + 1);
+		__atomic_store_n(slot, v, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lsyms.lock);
 	return v;
 }
 
-lval* lval_sexpr(void) {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_SEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
+// Garbage collector
+//
+// Collection only happens at safepoints, and the collector only knows
+// about the roots registered with lgc_root and lgc_root_stack, so anything that evaluates
+// must root the lvals it still needs once the evaluation returns. The
+// collector moves young objects, which is why a root is the address of a
+// variable rather than the lval itself.
+//
+// A minor collection copies the young objects reachable from the roots
+// and from the remembered set, the old objects written since the last
+// minor collection, into the old generation.
+//
+// A major collection starts after a minor one once the old generation
+// has outgrown its threshold, and first marks everything the roots reach.
+// Each safepoint after LGC_SLICE_BYTES of allocation does another slice
+// that looks at about LGC_MARK_BUDGET cells. Objects promoted meanwhile
+// are marked through by the minor collection that copies them. When
+// nothing is left to mark, the next minor collection rescans the roots
+// and finishes marking; at that point nothing is young, so young objects
+// never need marks. Sweeping is sliced in the same way,
+// LGC_SWEEP_BUDGET slabs or that many slabs' worth of big objects at a
+// time.
+//
+// Stores into an existing list go through lgc_write, see there.
+//
+// With lgc.stress set, every safepoint does a minor collection and a
+// slice, and every minor collection starts a major one if none is under
+// way, so an lval left unrooted across a safepoint is moved or freed at
+// the first chance rather than once the heap happens to fill.
+
+#define LGC_NURSERY_SIZE  (1024 * 1024)
+#define LGC_SLICE_BYTES   (64 * 1024)
+#define LGC_MARK_BUDGET   4096
+#define LGC_SWEEP_BUDGET  8
+#define LGC_MIN_HEAP      (4 * 1024 * 1024)
+
+double now_ms(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+void lval_stack_reserve(lval_stack* s, int n) {
+	if (s->count + n <= s->cap) { return; }
+	s->cap = s->cap ? s->cap * 2 : 64;
+	if (s->cap < s->count + n) { s->cap = s->count + n; }
+	s->items = realloc(s->items, sizeof(lval*) * s->cap);
+}
+
+// Make room for one more after the first "count" items of a growable
+// array of "size" byte items, returning where the array now is
+void* lgrow(void* items, int* cap, int count, size_t size) {
+	if (count < *cap) { return items; }
+	*cap = *cap ? *cap * 2 : 64;
+	return realloc(items, size * *cap);
+}
+
+void lgc_push(lgc_stack* s, uintptr_t item) {
+	if (s->count == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 256;
+		s->items = realloc(s->items, sizeof(uintptr_t) * s->cap);
+	}
+	s->items[s->count++] = item;
+}
+
+void lgc_root(lval** slot) {
+	lgc_push(&lgc.roots, (uintptr_t) slot);
+}
+
+void lgc_unroot(int n) {
+	lgc.roots.count -= n;
+}
+
+void lgc_root_stack(lval_stack* s) {
+	lgc_push(&lgc.stacks, (uintptr_t) s);
+}
+
+unsigned char* lgc_flags(uintptr_t item) {
+	if (item & LGC_CELLS) { return &((lcells*) (item & ~LGC_CELLS))->flags; }
+	return &((lval*) item)->flags;
+}
+
+bool lgc_is_list(lval* v) {
+	return v->type == LVAL_SEXPR || v->type == LVAL_QEXPR || v->type == LVAL_LAMBDA ||
+		v->type == LVAL_FUTURE || v->type == LVAL_CHAN;
+}
+
+// Marking
+
+// Objects are pushed once, when they are first marked or promoted
+void lgc_gray(uintptr_t item) {
+	lgc_push(&lgc.gray, item);
+}
+
+void lgc_mark(lval* v) {
+	if (lval_is_immediate(v) || (v->flags & (LVAL_INTERNED | LGC_YOUNG))) { return; }
+	if (lmem_marked(v, v->flags)) { return; }
+	lmem_set_mark(v, v->flags);
+	if (lgc_is_list(v)) { lgc_gray((uintptr_t) v); }
+}
+
+void lgc_mark_cells(lcells* c) {
+	if ((c->flags & LGC_YOUNG) || lmem_marked(c, c->flags)) { return; }
+	lmem_set_mark(c, c->flags);
+	lgc_gray((uintptr_t) c | LGC_CELLS);
+}
+
+// Mark the children of a gray object
+void lgc_blacken(uintptr_t item) {
+	if (item & LGC_CELLS) {
+		lcells* c = (lcells*) (item & ~LGC_CELLS);
+		for (int i = c->start; i < c->end; i++) { lgc_mark(c->slot[i]); }
+		return;
+	}
+	lval* v = (lval*) item;
+	if (v->cells) {
+		lgc_mark_cells(v->cells);
+	} else {
+		for (int i = 0; i < v->count; i++) { lgc_mark(v->cell[i]); }
+	}
+}
+
+void lgc_mark_roots(void) {
+	for (int i = 0; i < lgc.roots.count; i++) {
+		lgc_mark(*(lval**) lgc.roots.items[i]);
+	}
+	for (int i = 0; i < lgc.stacks.count; i++) {
+		lval_stack* s = (lval_stack*) lgc.stacks.items[i];
+		for (int j = 0; j < s->count; j++) { lgc_mark(s->items[j]); }
+	}
+}
+
+bool lgc_mark_done(void) {
+	return lgc.gray.count == 0 && lgc.scan_cells == NULL;
+}
+
+// Mark the children of gray objects until about "budget" cells have
+// been looked at. Big blocks are split across calls.
+void lgc_mark_step(long budget) {
+	long work = 0;
+	while (work < budget) {
+		lcells* c = lgc.scan_cells;
+		if (c) {
+			long to = c->end < lgc.scan_next + budget - work ? c->end : lgc.scan_next + budget - work;
+			for (int i = lgc.scan_next; i < to; i++) { lgc_mark(c->slot[i]); }
+			work += to - lgc.scan_next + 1;
+			lgc.scan_next = to;
+			if (to == c->end) { lgc.scan_cells = NULL; }
+			continue;
+		}
+		
+		if (lgc.gray.count == 0) { return; }
+		uintptr_t item = lgc.gray.items[--lgc.gray.count];
+		if (item & LGC_CELLS) {
+			c = (lcells*) (item & ~LGC_CELLS);
+			lgc.scan_cells = c;
+			lgc.scan_next = c->start;
+		} else {
+			lgc_blacken(item);
+			work += 1 + ((lval*) item)->count;
+		}
+	}
+}
+
+void lgc_remember(lval* v) {
+	if (v->flags & LGC_REMEMBERED) { return; }
+	v->flags |= LGC_REMEMBERED;
+	lgc_push(&lgc.remembered, (uintptr_t) v);
+}
+
+void lgc_remember_cells(lcells* c, int from, int to) {
+	if (c->flags & LGC_REMEMBERED) {
+		if (from < c->dirty_from) { c->dirty_from = from; }
+		if (to > c->dirty_to) { c->dirty_to = to; }
+		return;
+	}
+	c->flags |= LGC_REMEMBERED;
+	c->dirty_from = from;
+	c->dirty_to = to;
+	lgc_push(&lgc.remembered, (uintptr_t) c | LGC_CELLS);
+}
+
+// Write barrier, called after storing the n cells of v from "from" on,
+// or after pointing v at a new block. Old objects that now point at young
+// ones are remembered. While marking, anything stored into an object
+// that is already marked is marked too, as the object may not be looked
+// at again.
+void lgc_write(lval* v, int from, int n) {
+	// Interned lists only ever hold what is never collected
+	if (v->flags & LVAL_INTERNED) { return; }
+	lcells* c = v->cells;
+	if (c && (c->flags & LGC_YOUNG) && !(v->flags & LGC_YOUNG)) { lgc_remember(v); }
+	
+	// The cells are in the block, or inline in v
+	unsigned char flags = c ? c->flags : v->flags;
+	if (flags & LGC_YOUNG) { return; }
+	bool mark = lgc.phase == LGC_MARK && lmem_marked(c ? (void*) c : (void*) v, flags);
+	
+	bool young = false;
+	for (int i = from; i < from + n; i++) {
+		lval* x = v->cell[i];
+		if (lval_is_immediate(x)) { continue; }
+		if (x->flags & LGC_YOUNG) {
+			young = true;
+		} else if (mark) {
+			lgc_mark(x);
+		}
+	}
+	
+	if (!young) { return; }
+	if (c) {
+		int slot = v->cell - c->slot + from;
+		lgc_remember_cells(c, slot, slot + n);
+	} else {
+		lgc_remember(v);
+	}
+}
+
+// Copying
+
+lval* lgc_evacuate(lval* v) {
+	if (lval_is_immediate(v) || !(v->flags & LGC_YOUNG)) { return v; }
+	if (v->flags & LGC_FORWARDED) { return v->forward; }
+	
+	lval* x = v;
+	if (v->flags & LGC_LARGE) {
+		// Big objects are promoted where they are
+		v->flags &= ~LGC_YOUNG;
+		lmem_large_promote(v);
+	} else {
+		size_t size = lval_size(v);
+		x = lmem_old_alloc(size);
+		memcpy(x, v, size);
+		x->flags = v->flags & ~LGC_YOUNG;
+		
+		// Pointers into the trailing storage move with it
+		if (x->type == LVAL_ERR) { x->err = (char*) (x + 1); }
+		if (x->type == LVAL_I64VEC || x->type == LVAL_F64VEC) { x->f64 = (double*) (x + 1); }
+		if (lgc_is_list(x) && x->cells == NULL) {
+			x->cell = lval_inline_cells(x) + (v->cell - lval_inline_cells(v));
+		}
+		
+		v->flags |= LGC_FORWARDED;
+		v->forward = x;
+		lmem.promoted_bytes += size;
+	}
+	
+	if (lgc_is_list(x)) {
+		lgc_push(&lgc.work, (uintptr_t) x);
+		if (lgc.phase == LGC_MARK) { lgc_gray((uintptr_t) x); }
+	}
+	return x;
+}
+
+lcells* lgc_evacuate_cells(lcells* c) {
+	if (!(c->flags & LGC_YOUNG)) { return c; }
+	if (c->flags & LGC_FORWARDED) { return c->forward; }
+	
+	lcells* x = c;
+	if (c->flags & LGC_LARGE) {
+		c->flags &= ~LGC_YOUNG;
+		lmem_large_promote(c);
+	} else {
+		// Only the slots in use are worth copying
+		x = lmem_old_alloc(lcells_size(c));
+		memcpy(x, c, sizeof(lcells));
+		memcpy(x->slot + c->start, c->slot + c->start, sizeof(lval*) * (c->end - c->start));
+		x->flags = 0;
+		
+		c->flags |= LGC_FORWARDED;
+		c->forward = x;
+		lmem.promoted_bytes += lcells_size(c);
+	}
+	
+	lgc_push(&lgc.work, (uintptr_t) x | LGC_CELLS);
+	if (lgc.phase == LGC_MARK) { lgc_gray((uintptr_t) x | LGC_CELLS); }
+	return x;
+}
+
+void lgc_scan_slots(lcells* c, int from, int to) {
+	if (from < c->start) { from = c->start; }
+	if (to > c->end) { to = c->end; }
+	for (int i = from; i < to; i++) { c->slot[i] = lgc_evacuate(c->slot[i]); }
+}
+
+// Copy out the young children of an old object
+void lgc_scan(uintptr_t item) {
+	if (item & LGC_CELLS) {
+		lcells* c = (lcells*) (item & ~LGC_CELLS);
+		lgc_scan_slots(c, c->start, c->end);
+		return;
+	}
+	lval* v = (lval*) item;
+	if (v->cells) {
+		long offset = v->cell - v->cells->slot;
+		v->cells = lgc_evacuate_cells(v->cells);
+		v->cell = v->cells->slot + offset;
+	} else {
+		for (int i = 0; i < v->count; i++) { v->cell[i] = lgc_evacuate(v->cell[i]); }
+	}
+}
+
+void lgc_major_start(void) {
+	lmem_clear_marks();
+	lgc.phase = LGC_MARK;
+	lgc.majors++;
+	lgc_mark_roots();
+}
+
+// Called with nothing young, so everything live is either marked already
+// or reachable from a root or a gray object
+void lgc_major_finish(void) {
+	lgc_mark_roots();
+	while (!lgc_mark_done()) { lgc_mark_step(LGC_MARK_BUDGET); }
+	lgc.phase = LGC_SWEEP;
+	lgc.sweep_next = 0;
+	lgc.sweep_large = &lmem.large;
+}
+
+void lgc_minor(void) {
+	// Marking has caught up, so this is the time to finish it
+	bool finish = lgc.phase == LGC_MARK && lgc_mark_done();
+	int promoted_from = lgc.gray.count;
+	
+	for (int i = 0; i < lgc.roots.count; i++) {
+		lval** slot = (lval**) lgc.roots.items[i];
+		*slot = lgc_evacuate(*slot);
+	}
+	for (int i = 0; i < lgc.stacks.count; i++) {
+		lval_stack* s = (lval_stack*) lgc.stacks.items[i];
+		for (int j = 0; j < s->count; j++) { s->items[j] = lgc_evacuate(s->items[j]); }
+	}
+	// Only the written slots of a remembered block can hold young values
+	for (int i = 0; i < lgc.remembered.count; i++) {
+		uintptr_t item = lgc.remembered.items[i];
+		*lgc_flags(item) &= ~LGC_REMEMBERED;
+		if (item & LGC_CELLS) {
+			lcells* c = (lcells*) (item & ~LGC_CELLS);
+			lgc_scan_slots(c, c->dirty_from, c->dirty_to);
+		} else {
+			lgc_scan(item);
+		}
+	}
+	lgc.remembered.count = 0;
+	while (lgc.work.count) { lgc_scan(lgc.work.items[--lgc.work.count]); }
+	
+	// Objects promoted while marking were pushed gray. Marking their
+	// children now costs no more than copying them did, and keeps the
+	// marking slices down to the old generation alone. Big blocks were
+	// not copied, so they are left for the slices.
+	int promoted_to = lgc.gray.count;
+	int kept = promoted_from;
+	for (int i = promoted_from; i < promoted_to; i++) {
+		uintptr_t item = lgc.gray.items[i];
+		if (*lgc_flags(item) & LGC_LARGE) {
+			lgc.gray.items[kept++] = item;
+		} else {
+			lgc_blacken(item);
+		}
+	}
+	if (promoted_to > kept) {
+		memmove(&lgc.gray.items[kept], &lgc.gray.items[promoted_to],
+		        sizeof(uintptr_t) * (lgc.gray.count - promoted_to));
+		lgc.gray.count -= promoted_to - kept;
+	}
+	
+	lmem_nursery_reset();
+	lgc.minors++;
+	lgc.line_minors++;
+	
+	if (finish) {
+		lgc_major_finish();
+	} else if (lgc.phase == LGC_IDLE && (lgc.stress ||
+	           (lmem.old_bytes > lgc.threshold && lmem.old_bytes > LGC_MIN_HEAP))) {
+		lgc_major_start();
+	}
+}
+
+// One bounded step of an incremental major collection, paying for
+// LGC_SLICE_BYTES of allocation
+void lgc_slice(void) {
+	lmem.slice_bytes = lmem.slice_bytes > LGC_SLICE_BYTES ? lmem.slice_bytes - LGC_SLICE_BYTES : 0;
+	
+	if (lgc.phase == LGC_MARK) {
+		lgc_mark_step(LGC_MARK_BUDGET);
+		return;
+	}
+	
+	if (lgc.phase == LGC_SWEEP) {
+		if (lgc.sweep_next < lmem.slab_count) {
+			for (int n = 0; n < LGC_SWEEP_BUDGET && lgc.sweep_next < lmem.slab_count; n++) {
+				lmem_sweep_slab(lmem.slabs[lgc.sweep_next++]);
+			}
+			return;
+		}
+		lgc.sweep_large = lmem_sweep_large(lgc.sweep_large, LGC_SWEEP_BUDGET * LMEM_SLAB_SIZE);
+		if (lgc.sweep_large == NULL) {
+			lgc.threshold = 2 * lmem.old_bytes;
+			lgc.phase = LGC_IDLE;
+		}
+	}
+}
+
+void lgc_pause(double ms) {
+	lgc.pauses[lgc.pause_count++ % LGC_PAUSES] = ms;
+	if (ms > lgc.line_pause_max) { lgc.line_pause_max = ms; }
+}
+
+bool lpar_busy(void);
+
+// Do whatever collector work is due. Every lval the caller still needs
+// afterwards must be rooted. Nothing is done while tasks of a parallel
+// evaluation are reading the heap.
+void lgc_safepoint(void) {
+	if (lpar_busy()) { return; }
+	if (lgc.stress) {
+		double start = now_ms();
+		lgc_minor();
+		if (lgc.phase != LGC_IDLE) { lgc_slice(); }
+		lgc_pause(now_ms() - start);
+		return;
+	}
+	bool minor = lmem.nursery_bytes >= LGC_NURSERY_SIZE ||
+		(lgc.phase == LGC_MARK && lgc_mark_done());
+	bool slice = lgc.phase != LGC_IDLE && lmem.slice_bytes >= LGC_SLICE_BYTES;
+	if (!minor && !slice) { return; }
+	
+	double start = now_ms();
+	if (minor) {
+		lgc_minor();
+	} else {
+		lgc_slice();
+	}
+	lgc_pause(now_ms() - start);
+}
+
+// Catch up on the slices allocation has paid for. Unlike a minor
+// collection, slices move nothing, so this is safe outside a safepoint.
+void lgc_pace(void) {
+	if (lpar_busy()) { return; }
+	if (lgc.phase == LGC_IDLE || lmem.slice_bytes < LGC_SLICE_BYTES) { return; }
+	double start = now_ms();
+	while (lgc.phase != LGC_IDLE && lmem.slice_bytes >= LGC_SLICE_BYTES) { lgc_slice(); }
+	lgc_pause(now_ms() - start);
+}
+
+// End of a REPL line: empty the nursery and move any major collection on
+void lgc_line_end(void) {
+	double start = now_ms();
+	lgc_minor();
+	if (lgc.phase != LGC_IDLE) { lgc_slice(); }
+	lgc_pause(now_ms() - start);
+}
+
+int lgc_compare_pauses(const void* a, const void* b) {
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+// Pause time at the given percentile of the recent pauses
+double lgc_pause_percentile(double* sorted, int n, int percentile) {
+	if (n == 0) { return 0; }
+	int i = (n * percentile + 99) / 100 - 1;
+	return sorted[i < 0 ? 0 : i];
+}
+
+lcells* lcells_new(int cap, int start) {
+	size_t size = sizeof(lcells) + sizeof(lval*) * cap;
+	lcells* c = lmem_alloc(size);
+	c->flags = lmem_flags(size);
+	c->start = start;
+	c->end = start;
+	c->cap = cap;
+	return c;
+}
+
+// Empty S- or Q-expression with room for "size" cells before it allocates
+lval* lval_list(int type, int size) {
+	if (size <= LVAL_INLINE_MAX) {
+		lval* v = lval_new(type, sizeof(lval*) * size);
+		v->inline_cap = size;
+		v->cell = lval_inline_cells(v);
+		return v;
+	}
+	lval* v = lval_new(type, 0);
+	v->cells = lcells_new(size, 0);
+	v->cell = v->cells->slot;
+	return v;
+}
+
+lval* lval_sexpr(void) {
+	return lval_list(LVAL_SEXPR, 0);
+}
+
+lval* lval_qexpr(void) {
+	return lval_list(LVAL_QEXPR, 0);
+}
+
+lval* lval_err(char* m) {
+	lval* v = lval_new(LVAL_ERR, strlen(m) + 1);
+	v->err = (char*) (v + 1);
+	strcpy(v->err, m);
+  return v;
+}
+
+// The parsers of the grammar. Like its heap, each isolate has its own,
+// built as it starts and freed as it ends.
+__thread struct {
+	mpc_parser_t* integer;
+	mpc_parser_t* floating;
+	mpc_parser_t* symbol;
+	mpc_parser_t* sexpr;
+	mpc_parser_t* qexpr;
+	mpc_parser_t* vector;
+	mpc_parser_t* expr;
+	mpc_parser_t* bilisp;
+} lgrammar;
+
+void lgrammar_init(void) {
+	lgrammar.integer = mpc_new("integer");
+	lgrammar.floating = mpc_new("float");
+	lgrammar.symbol = mpc_new("symbol");
+	lgrammar.sexpr = mpc_new("sexpr");
+	lgrammar.qexpr = mpc_new("qexpr");
+	lgrammar.vector = mpc_new("vector");
+	lgrammar.expr = mpc_new("expr");
+	lgrammar.bilisp = mpc_new("bilisp");
+	
+	mpca_lang(MPCA_LANG_DEFAULT,
+  	" \
+			integer	 : /-?[0-9]+/ ;	\
+			float    : <integer> '.'<integer>;	\
+  		symbol   : /[a-zA-Z_][a-zA-Z0-9_?!-]*/ \
+  						 | '+' \
+  						 | '-' \
+  						 | '*' \
+  						 | '/' \
+  						 | '^' \
+  						 | '%' \
+  						 | '\\\\' ; \
+  		sexpr    : '(' <expr>* ')' ; \
+  		qexpr    : '{' <expr>* '}' ; \
+  		vector   : '[' (<float> | <integer>)* ']' ; \
+  		expr     : <float> \
+  						 | <integer> \
+  						 | <symbol> \
+  						 | <qexpr> \
+  						 | <sexpr> \
+  						 | <vector> ; \
+  		bilisp   : /^/ <expr>* /$/ ; \
+  	",
+  	lgrammar.integer, lgrammar.floating, lgrammar.symbol, lgrammar.sexpr,
+  	lgrammar.qexpr, lgrammar.vector, lgrammar.expr, lgrammar.bilisp);
+}
+
+void lgrammar_free(void) {
+	mpc_cleanup(8, lgrammar.integer, lgrammar.floating, lgrammar.symbol, lgrammar.sexpr,
+		lgrammar.qexpr, lgrammar.vector, lgrammar.expr, lgrammar.bilisp);
+}
+
+lval* lval_read_int(mpc_ast_t* ast) {
+	errno = 0;
+	long x = strtol(ast->contents, NULL, 10);
+	return errno != ERANGE ?
+		lval_int(x) : lval_err("Invalid integer");
+}
+
+lval* lval_read_float(mpc_ast_t* ast) {
+	errno = 0;
+	char* float_string;
+	float_string = (char *) malloc(sizeof(char));
+  *float_string = '\0';
+	for (int i = 0; i < ast->children_num; i++) {
+		char* child = ast->children[i]->contents;
+		float_string = realloc(float_string, strlen(float_string) + strlen(child) + 1);
+		strcat(float_string, child);
+	}
+	double x = strtod(float_string, NULL);
+	free(float_string);
+	return errno != ERANGE ? lval_float(x) : lval_err("Invalid float");
+}
+
+// New list of the same type viewing n cells of v starting at "from". A
+// block is shared rather than copied; inline cells are few enough to copy.
+lval* lval_slice(lval* v, int from, int n) {
+	if (v->cells == NULL) {
+		lval* x = lval_list(v->type, n);
+		for (int i = 0; i < n; i++) {
+			x->cell[i] = v->cell[from + i];
+		}
+		x->count = n;
+		// Shared nodes keep any number of cells inline, so the copy of
+		// one can need a block
+		if (x->cells) { x->cells->end = n; }
+		return x;
+	}
+	
+	lval* x = lval_new(v->type, 0);
+	x->cells = v->cells;
+	x->cell = v->cell + from;
+	x->count = n;
+	return x;
+}
+
+// New list holding a copy of the n lvals at "items"
+lval* lval_list_of(int type, lval** items, int n) {
+	lval* v = lval_list(type, n);
+	if (n) { memcpy(v->cell, items, sizeof(lval*) * n); }
+	v->count = n;
+	if (v->cells) { v->cells->end = n; }
+	lgc_write(v, 0, n);
+	return v;
+}
+
+// Make sure v can take "front" more cells before its first one and "back"
+// more after its last one without touching cells another list can see.
+// When the cells have to move they go to a fresh block at least twice
+// the size, with the slack at whichever end ran out. Only the caller may
+// hold v.
+void lval_reserve(lval* v, int front, int back) {
+	lcells* c = v->cells;
+	if (c == NULL) {
+		if (front == 0 && v->count + back <= v->inline_cap) { return; }
+	} else {
+		// A task may only write to what it allocated itself, as other
+		// threads can be reading the heap's blocks
+		bool own = lpar_arena_now == NULL || (c->flags & LVAL_INTERNED);
+		bool at_start = v->cell == c->slot + c->start;
+		bool at_end = v->cell + v->count == c->slot + c->end;
+		if (own && (front == 0 || (at_start && c->start >= front)) &&
+		    (back == 0 || (at_end && c->cap - c->end >= back))) {
+			return;
+		}
+	}
+	
+	int cap = 2 * (c ? c->cap : v->inline_cap);
+	if (cap < v->count + front + back) { cap = v->count + front + back; }
+	if (cap < 4) { cap = 4; }
+	int slack = cap - v->count - front - back;
+	int start = front ? front + slack : 0;
+	
+	lcells* block = lcells_new(cap, start);
+	if (v->count) { memcpy(block->slot + start, v->cell, sizeof(lval*) * v->count); }
+	block->end = start + v->count;
+	
+	v->cells = block;
+	v->cell = block->slot + start;
+	lgc_write(v, 0, v->count);
+}
+
+// Add to the end or the front of a list header the caller has just made
+lval* lval_add(lval* list, lval* element) {
+	lval_reserve(list, 0, 1);
+	list->cell[list->count++] = element;
+	if (list->cells) { list->cells->end++; }
+	lgc_write(list, list->count - 1, 1);
+	return list;
+}
+
+lval* lval_append(lval* element, lval* list) {
+	lval_reserve(list, 1, 0);
+	if (list->cells) {
+		list->cell--;
+		list->cells->start--;
+	} else {
+		memmove(&list->cell[1], &list->cell[0], sizeof(lval*) * list->count);
+	}
+	list->count++;
+	list->cell[0] = element;
+	lgc_write(list, 0, 1);
+	return list;
+}
+
+lval* lbuiltin_find(char* name);
+
+// Names of builtins are linked to the builtin here, once, rather than
+// looked up whenever they are called
+lval* lval_read_sym(mpc_ast_t* ast) {
+	lval* b = lbuiltin_find(ast->contents);
+	return b ? b : lval_sym(ast->contents);
+}
+
+bool lval_read_is_expr(mpc_ast_t* child) {
+	if (strcmp(child->contents, "(") == 0) { return false; }
+	if (strcmp(child->contents, ")") == 0) { return false; }
+	if (strcmp(child->contents, "{") == 0) { return false; }
+	if (strcmp(child->contents, "}") == 0) { return false; }
+	if (strcmp(child->contents, "[") == 0) { return false; }
+	if (strcmp(child->contents, "]") == 0) { return false; }
+	if (strcmp(child->tag, "regex") == 0) { return false; }
+	return true;
+}
+
+lval* lval_read_atom(mpc_ast_t* ast);
+lval* lvec_of(lval** items, int n);
+
+// A vector literal such as [1 2 3], read as a list of its numbers first
+lval* lval_read_vec(mpc_ast_t* ast) {
+	lval* x = lval_list(LVAL_SEXPR, ast->children_num);
+	for (int i = 0; i < ast->children_num; i++) {
+		if (!lval_read_is_expr(ast->children[i])) { continue; }
+		lval* y = lval_read_atom(ast->children[i]);
+		if (lval_type(y) == LVAL_ERR) { return y; }
+		x = lval_add(x, y);
+	}
+	return lvec_of(x->cell, x->count);
+}
+
+// Read anything but a list, or return NULL for a list
+lval* lval_read_atom(mpc_ast_t* ast) {
+	if (strstr(ast->tag, "int")) { return lval_read_int(ast); }
+	if (strstr(ast->tag, "float")) { return lval_read_float(ast); }
+	if (strstr(ast->tag, "symbol")) { return lval_read_sym(ast); }
+	if (strstr(ast->tag, "vector")) { return lval_read_vec(ast); }
+	return NULL;
+}
+
+// Empty list for a list in the tree
+lval* lval_read_list(mpc_ast_t* ast) {
+	
+	// Brackets and the start/end of input regexes are not expressions
+	int count = 0;
+	for (int i = 0; i < ast->children_num; i++) {
+		if (lval_read_is_expr(ast->children[i])) { count++; }
+	}
+	
+	// If root ">", sexpr, or qexpr then create empty list, sized so small
+	// lists keep their cells inline
+	int type = strstr(ast->tag, "qexpr") ? LVAL_QEXPR : LVAL_SEXPR;
+	return lval_list(type, count);
+}
+
+// A list part way through being walked
+typedef struct {
+	lval* list;
+	int next;
+} lwalk;
+
+// Hash-consing
+//
+// With --hash-cons the reader keeps one copy of each distinct Q-expression
+// it reads, and of each atom in one that is not an immediate or already
+// interned: reading the same structure again gives the node it made the
+// first time. The items of a shared node are shared nodes too, so two
+// shared nodes are structurally equal exactly when they are the same node.
+// Like symbols, shared nodes are allocated outside the collected heap and
+// live for the whole session. They never change, except that quickening
+// may swap the builtin of an S-expression in one for a form of it that
+// prints and evaluates the same.
+//
+// Each shared node carries its structural hash just in front of it. The
+// table is open addressed with linear probing and kept at most half full.
+
+// A shared node; the lval's trailing storage follows it
+typedef struct {
+	uint64_t hash;
+	// For a list, whether lmemo_is_pure holds of it
+	bool pure;
+	lval v;
+} lhcons_node;
+
+__thread struct {
+	bool on;
+	lval** slots;
+	int capacity;
+	int count;
+	// Reads that found their node already in the table, and the bytes
+	// the nodes take
+	long shared;
+	size_t bytes;
+} lhcons;
+
+lval* lquick_generic(lval* f);
+bool lmemo_is_pure(lval* v);
+
+bool lval_is_hashed(lval* v) {
+	return !lval_is_immediate(v) && (v->flags & LVAL_HASHED);
+}
+
+lhcons_node* lhcons_node_of(lval* v) {
+	return (lhcons_node*) ((char*) v - offsetof(lhcons_node, v));
+}
+
+uint64_t lhash_mix(uint64_t h, uint64_t x) {
+	h = (h ^ x) * 0x100000001B3ULL;
+	return h ^ (h >> 29);
+}
+
+uint64_t lhash_bytes(uint64_t h, void* bytes, size_t n) {
+	unsigned char* b = bytes;
+	for (size_t i = 0; i < n; i++) { h = lhash_mix(h, b[i]); }
+	return h;
+}
+
+// The hash of anything but a list whose items have to be looked at
+uint64_t lval_hash_atom(lval* v) {
+	if (lval_is_immediate(v)) { return lhash_mix(0, (uintptr_t) v); }
+	if (v->flags & LVAL_HASHED) {
+		return lhcons_node_of(v)->hash;
+	}
+	uint64_t h = lhash_mix(0, v->type);
+	switch (v->type) {
+	case LVAL_INT: return lhash_mix(h, v->i);
+	case LVAL_ERR: return lhash_bytes(h, v->err, strlen(v->err));
+	case LVAL_I64VEC:
+	case LVAL_F64VEC: return lhash_bytes(h, v->f64, sizeof(double) * v->count);
+	case LVAL_LOCAL: return lhash_mix(h, v->slot);
+	case LVAL_BUILTIN: return lhash_mix(h, (uintptr_t) lquick_generic(v));
+	}
+	// Symbols are interned and lambdas compare by identity
+	return lhash_mix(h, (uintptr_t) v);
+}
+
+// Lists whose hash comes from their items
+bool lval_is_walked(lval* v) {
+	return !lval_is_immediate(v) && !(v->flags & LVAL_HASHED) &&
+		(v->type == LVAL_SEXPR || v->type == LVAL_QEXPR);
+}
+
+// Structural hash of v, which for a shared node is the one it carries.
+// Lists are walked on a stack of their own, each one's hash built up as
+// its items are done.
+uint64_t lval_hash(lval* v) {
+	static __thread lwalk* open;
+	static __thread uint64_t* hashes;
+	static __thread int cap;
+	static __thread int hash_cap;
+	if (!lval_is_walked(v)) { return lval_hash_atom(v); }
+	
+	int count = 0;
+	open = lgrow(open, &cap, count, sizeof(lwalk));
+	hashes = lgrow(hashes, &hash_cap, count, sizeof(uint64_t));
+	open[count] = (lwalk) { v, 0 };
+	hashes[count++] = lhash_mix(lhash_mix(0, v->type), v->count);
+	while (true) {
+		lwalk* w = &open[count - 1];
+		if (w->next == w->list->count) {
+			uint64_t h = hashes[--count];
+			if (count == 0) { return h; }
+			hashes[count - 1] = lhash_mix(hashes[count - 1], h);
+			continue;
+		}
+		lval* x = w->list->cell[w->next++];
+		if (lval_is_walked(x)) {
+			open = lgrow(open, &cap, count, sizeof(lwalk));
+			hashes = lgrow(hashes, &hash_cap, count, sizeof(uint64_t));
+			open[count] = (lwalk) { x, 0 };
+			hashes[count++] = lhash_mix(lhash_mix(0, x->type), x->count);
+		} else {
+			hashes[count - 1] = lhash_mix(hashes[count - 1], lval_hash_atom(x));
+		}
+	}
+}
+
+// Whether x and y, which are not both lists, are equal
+bool lval_equal_atom(lval* x, lval* y) {
+	if (x == y) { return true; }
+	if (lval_is_immediate(x) || lval_is_immediate(y)) { return false; }
+	if (x->type != y->type) { return false; }
+	if ((x->flags & LVAL_HASHED) && (y->flags & LVAL_HASHED)) { return false; }
+	switch (x->type) {
+	case LVAL_INT: return x->i == y->i;
+	case LVAL_ERR: return strcmp(x->err, y->err) == 0;
+	case LVAL_I64VEC:
+	case LVAL_F64VEC:
+		return x->count == y->count && memcmp(x->f64, y->f64, sizeof(double) * x->count) == 0;
+	case LVAL_LOCAL: return x->slot == y->slot;
+	case LVAL_BUILTIN: return lquick_generic(x) == lquick_generic(y);
+	}
+	return false;
+}
+
+bool lval_is_list_value(lval* v) {
+	return !lval_is_immediate(v) && (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR);
+}
+
+// Whether x and y have the same structure. Two shared nodes take one
+// comparison; other lists are walked side by side.
+bool lval_equal(lval* x, lval* y) {
+	static __thread lwalk* open;
+	static __thread lval** other;
+	static __thread int cap;
+	static __thread int other_cap;
+	int count = 0;
+	
+	while (true) {
+		if (lval_is_list_value(x) && lval_is_list_value(y)) {
+			if (x != y) {
+				if (lval_is_hashed(x) && lval_is_hashed(y)) { return false; }
+				if (x->type != y->type || x->count != y->count) { return false; }
+				open = lgrow(open, &cap, count, sizeof(lwalk));
+				other = lgrow(other, &other_cap, count, sizeof(lval*));
+				open[count] = (lwalk) { x, 0 };
+				other[count++] = y;
+			}
+		} else if (!lval_equal_atom(x, y)) {
+			return false;
+		}
+		
+		// On to the next pair of items, past any lists that are done
+		while (count > 0 && open[count - 1].next == open[count - 1].list->count) { count--; }
+		if (count == 0) { return true; }
+		lwalk* w = &open[count - 1];
+		y = other[count - 1]->cell[w->next];
+		x = w->list->cell[w->next++];
+	}
+}
+
+void lhcons_grow(void) {
+	int old_capacity = lhcons.capacity;
+	lval** old = lhcons.slots;
+	lhcons.capacity = old_capacity ? old_capacity * 2 : 1024;
+	lhcons.slots = calloc(lhcons.capacity, sizeof(lval*));
+	for (int i = 0; i < old_capacity; i++) {
+		if (old[i] == NULL) { continue; }
+		int j = lval_hash(old[i]) & (lhcons.capacity - 1);
+		while (lhcons.slots[j]) { j = (j + 1) & (lhcons.capacity - 1); }
+		lhcons.slots[j] = old[i];
+	}
+	free(old);
+}
+
+// The shared node for v, a Q-expression whose items are shared already
+// or an atom, made if this is the first time it is seen
+lval* lhcons_share(lval* v) {
+	if (lval_is_immediate(v) || (v->flags & LVAL_INTERNED)) { return v; }
+	int type = v->type;
+	bool list = type == LVAL_SEXPR || type == LVAL_QEXPR;
+	if (!list && type != LVAL_INT && type != LVAL_ERR && type != LVAL_I64VEC && type != LVAL_F64VEC) {
+		return v;
+	}
+	// Shared lists keep their cells inline
+	if (list && v->count > USHRT_MAX) { return v; }
+	
+	if (2 * (lhcons.count + 1) > lhcons.capacity) { lhcons_grow(); }
+	uint64_t hash = lval_hash(v);
+	int i = hash & (lhcons.capacity - 1);
+	for (; lhcons.slots[i]; i = (i + 1) & (lhcons.capacity - 1)) {
+		if (lval_hash(lhcons.slots[i]) == hash && lval_equal(lhcons.slots[i], v)) {
+			lhcons.shared++;
+			return lhcons.slots[i];
+		}
+	}
+	
+	size_t size = list ? sizeof(lval) + sizeof(lval*) * v->count : lval_size(v);
+	lhcons_node* n = malloc(offsetof(lhcons_node, v) + size);
+	n->hash = hash;
+	n->pure = list && lmemo_is_pure(v);
+	lval* x = &n->v;
+	*x = *v;
+	x->flags = LVAL_INTERNED | LVAL_HASHED;
+	memcpy(x + 1, list ? (void*) v->cell : (void*) (v + 1), size - sizeof(lval));
+	if (list) {
+		x->inline_cap = v->count;
+		x->cells = NULL;
+		x->cell = lval_inline_cells(x);
+	} else if (type == LVAL_ERR) {
+		x->err = (char*) (x + 1);
+	} else if (type != LVAL_INT) {
+		x->f64 = (double*) (x + 1);
+	}
+	
+	lhcons.slots[i] = x;
+	lhcons.count++;
+	lhcons.bytes += offsetof(lhcons_node, v) + size;
+	return x;
+}
+
+// A list being frozen by lhcons_freeze, and its copy so far
+typedef struct {
+	lval* list;
+	lval* copy;
+	int next;
+} lfreeze_frame;
+
+// A shared copy of the whole of v, made bottom up, or NULL if some part
+// of it cannot be shared. Nothing in it is ever collected or changed, so
+// any thread can read it while the collector runs.
+lval* lhcons_freeze(lval* v) {
+	static __thread lfreeze_frame* open;
+	static __thread int cap;
+	int count = 0;
+	if (!lval_is_list_value(v) || (v->flags & LVAL_INTERNED)) {
+		v = lhcons_share(v);
+		return lval_is_immediate(v) || (v->flags & LVAL_INTERNED) ? v : NULL;
+	}
+	open = lgrow(open, &cap, count, sizeof(lfreeze_frame));
+	open[count++] = (lfreeze_frame) { v, lval_list(v->type, v->count), 0 };
+	
+	while (true) {
+		lfreeze_frame* f = &open[count - 1];
+		if (f->next == f->list->count) {
+			lval* x = lhcons_share(f->copy);
+			if (!(x->flags & LVAL_INTERNED)) { return NULL; }
+			if (--count == 0) { return x; }
+			open[count - 1].copy = lval_add(open[count - 1].copy, x);
+			continue;
+		}
+		
+		lval* x = f->list->cell[f->next++];
+		if (lval_is_list_value(x) && !(x->flags & LVAL_INTERNED)) {
+			open = lgrow(open, &cap, count, sizeof(lfreeze_frame));
+			open[count++] = (lfreeze_frame) { x, lval_list(x->type, x->count), 0 };
+			continue;
+		}
+		x = lhcons_share(x);
+		if (!lval_is_immediate(x) && !(x->flags & LVAL_INTERNED)) { return NULL; }
+		f->copy = lval_add(f->copy, x);
+	}
+}
+
+void lhcons_print_stats(void) {
+	printf(";; hash-consing: %d shared nodes (%zu bytes), %li reads shared\n",
+	       lhcons.count, lhcons.bytes, lhcons.shared);
+}
+
+// A list the reader is part way through, and whether it is in a
+// Q-expression
+typedef struct {
+	mpc_ast_t* ast;
+	lval* list;
+	int next;
+	bool quoted;
+} lread_frame;
+
+// Lists are read from a stack of the ones still open rather than by
+// recursing, so however deeply the input nests it cannot overflow the C
+// stack here
+lval* lval_read(mpc_ast_t* ast) {
+	lval* x = lval_read_atom(ast);
+	if (x) { return x; }
+	
+	static __thread lread_frame* open;
+	static __thread int cap;
+	int count = 0;
+	lval* list = lval_read_list(ast);
+	open = lgrow(open, &cap, count, sizeof(lread_frame));
+	open[count++] = (lread_frame) { ast, list, 0, list->type == LVAL_QEXPR };
+	
+	while (true) {
+		lread_frame* f = &open[count - 1];
+		bool share = f->quoted && lhcons.on;
+		if (f->next < f->ast->children_num) {
+			mpc_ast_t* child = f->ast->children[f->next++];
+			if (!lval_read_is_expr(child)) { continue; }
+			x = lval_read_atom(child);
+			if (x) {
+				f->list = lval_add(f->list, share ? lhcons_share(x) : x);
+				continue;
+			}
+			list = lval_read_list(child);
+			bool quoted = f->quoted || list->type == LVAL_QEXPR;
+			open = lgrow(open, &cap, count, sizeof(lread_frame));
+			open[count++] = (lread_frame) { child, list, 0, quoted };
+			continue;
+		}
+		
+		// The list is done, so it is an item of the one it is in
+		x = share ? lhcons_share(f->list) : f->list;
+		if (--count == 0) { return x; }
+		open[count - 1].list = lval_add(open[count - 1].list, x);
+	}
+}
+
+void lvec_print(lval* v) {
+	putchar('[');
+	for (int i = 0; i < v->count; i++) {
+		if (v->type == LVAL_I64VEC) {
+			printf("%li", v->i64[i]);
+		} else {
+			// Its NaNs print as lval_float's do
+			double x = v->f64[i];
+			printf("%f", isnan(x) ? NAN : x);
+		}
+		if (i != v->count - 1) { putchar(' '); }
+	}
+	putchar(']');
+}
+
+// Print anything but a list
+void lval_print_atom(lval* v) {
+	switch (lval_type(v)) {
+		case LVAL_INT: printf("%li", lval_get_int(v)); break;
+		case LVAL_FLOAT: printf("%f", lval_get_float(v)); break;
+		case LVAL_ERR: printf("%s", v->err); break;
+		case LVAL_SYM: printf("%s", v->sym); break;
+		case LVAL_LOCAL: printf("%s", v->sym); break;
+		case LVAL_BUILTIN: printf("%s", v->name); break;
+		case LVAL_I64VEC:
+		case LVAL_F64VEC: lvec_print(v); break;
+		case LVAL_FUTURE: printf("<future>"); break;
+		case LVAL_CHAN: printf("<chan %d>", v->count); break;
+	}
+}
+
+// How many cells of a list to print: a lambda prints as its formals and
+// body, as it was written
+int lval_print_count(lval* list) {
+	return list->type == LVAL_LAMBDA ? LLAMBDA_CODE : list->count;
+}
+
+// Print an lval. Like the reader, this keeps the lists still open on a
+// stack of its own, as a result can nest as deeply as its input.
+void lval_print(lval* v) {
+	static __thread lwalk* open;
+	static __thread int cap;
+	int count = 0;
+	
+	while (true) {
+		int type = lval_type(v);
+		if (type == LVAL_SEXPR || type == LVAL_QEXPR || type == LVAL_LAMBDA) {
+			fputs(type == LVAL_SEXPR ? "(" : type == LVAL_QEXPR ? "{" : "(\\ ", stdout);
+			open = lgrow(open, &cap, count, sizeof(lwalk));
+			open[count++] = (lwalk) { v, 0 };
+		} else {
+			lval_print_atom(v);
+		}
+		
+		// Close the lists that are done, then print the next item
+		while (count > 0 && open[count - 1].next == lval_print_count(open[count - 1].list)) {
+			putchar(open[count - 1].list->type == LVAL_QEXPR ? '}' : ')');
+			count--;
+		}
+		if (count == 0) { return; }
+		lwalk* w = &open[count - 1];
+		if (w->next > 0) { putchar(' '); }
+		v = w->list->cell[w->next++];
+	}
+}
+
+void lval_println(lval* v) {lval_print(v); putchar('\n'); }
+
+void print_children_details(mpc_ast_t* ast) {
+	mpc_ast_t* child;
+	for (int i = 0; i < ast->children_num; i++) {
+		child = ast->children[i];
+		printf("\n------ Child Number %i ------\n", i);
+		printf("Child %i tag: %s\n", i, child->tag);
+		printf("Child %i contents: %s\n", i, child->contents);
+		printf("Child %i number of children: %i\n", i, child->children_num);
+		printf("\n");
+	}
+}
+
+// Builtins are called with their n arguments in an array. The array is
+// only theirs until they evaluate anything, as it may be part of the VM's
+// stack, so they must not touch it after that.
+
+lval* builtin_head(lval** args, int n) {
+	LASSERTARGS(n, 1, "head");
+	
+	LASSERT(args, lval_type(args[0]) == LVAL_QEXPR,
+	  "Function 'head' requires a Q-expression");
+	
+	LASSERT(args, args[0]->count != 0, 
+		"Function 'head' passed an empty Q-expression");
+	
+	// Copy out the first element rather than keep the whole list alive
+	lval* v = lval_list(LVAL_QEXPR, 1);
+	return lval_add(v, args[0]->cell[0]);
+}
+
+lval* builtin_tail(lval** args, int n) {
+	LASSERTARGS(n, 1, "tail");
+	
+	LASSERT(args, lval_type(args[0]) == LVAL_QEXPR,
+	  "Function 'tail' requires a Q-expression");
+	
+	LASSERT(args, args[0]->count != 0, 
+	  "Function 'tail' passed empty Q-expression {}");
+	
+	// A view of everything after the first element, sharing its cells
+	lval* q = args[0];
+	return lval_slice(q, 1, q->count - 1);
+}
+
+lval* builtin_len(lval** args, int n) {
+	LASSERTARGS(n, 1, "len");
+		
+	int type = lval_type(args[0]);
+	LASSERT(args, type == LVAL_QEXPR || type == LVAL_I64VEC || type == LVAL_F64VEC,
+		"Function 'len' requires a Q-expression or a vector");
+		
+	return lval_int(args[0]->count);
+}
+
+lval* builtin_cons(lval** args, int n) {
+	LASSERTARGS(n, 2, "cons");
+	
+	LASSERT(args, lval_type(args[1]) == LVAL_QEXPR,
+		"Second value to 'cons' is not a Q-Expression");
+	
+	lval* rest = args[1];
+	return lval_append(args[0], lval_slice(rest, 0, rest->count));
+}
+
+lval* builtin_list(lval** args, int n) {
+	return lval_list_of(LVAL_QEXPR, args, n);
+}
+
+lval* lval_eval_sexpr(lval* v);
+lval* lvm_eval_sexpr(lval* v);
+lval* builtin_eval(lval** args, int n) {
+	LASSERTARGS(n, 1, "eval");
+
+	LASSERT(args, lval_type(args[0]) == LVAL_QEXPR,
+	  "Function 'eval' not passed a Q-expression");
+	
+	// The evaluators run eval themselves, see LOP_EVAL, so this is only
+	// reached by a call they cannot. Evaluation never changes the list it
+	// is given, so the Q-expression can be evaluated as it is.
+	if (lvm.reference) { return lval_eval_sexpr(args[0]); }
+	return lvm_eval_sexpr(args[0]);
+}
+
+// Join y onto x, a list header the caller has just made
+lval* lval_join(lval* x, lval* y) {
+	
+	// When y is the longer list and x fits in the free slots in front of
+	// it, share y's cells and prepend instead
+	lcells* c = y->cells;
+	if (y->count > x->count && c && y->cell == c->slot + c->start && c->start >= x->count) {
+		y = lval_slice(y, 0, y->count);
+		for (int i = x->count - 1; i >= 0; i--) {
+			y = lval_append(x->cell[i], y);
+		}
+		return y;
+	}
+	
+	// Otherwise splice y onto x in one go. If x ends where its block does
+	// this extends the block in place and x's prefix stays shared.
+	int n = y->count;
+	lval_reserve(x, 0, n);
+	if (n) { memcpy(&x->cell[x->count], y->cell, sizeof(lval*) * n); }
+	x->count += n;
+	if (x->cells) { x->cells->end += n; }
+	lgc_write(x, x->count - n, n);
+	return x;
+}
+
+lval* builtin_join(lval** args, int n) {
+	for (int i = 0; i < n; i++) {
+		LASSERT(args, lval_type(args[i]) == LVAL_QEXPR,
+		  "Function 'join' passed incorrect type.");
+	}
+	
+	if (n == 0) { return lval_qexpr(); }
+	
+	lval* x = lval_slice(args[0], 0, args[0]->count);
+	for (int i = 1; i < n; i++) {
+		x = lval_join(x, args[i]);
+	}
+	
+	return x;
+}
+
+lval* builtin_gc_stat(char* name, lval* x) {
+	lval* v = lval_list(LVAL_QEXPR, 2);
+	v = lval_add(v, lval_sym(name));
+	return lval_add(v, x);
+}
+
+lval* builtin_gc(lval** args, int n) {
+	LASSERTARGS(n, 0, "gc");
+	
+	int count = lgc.pause_count < LGC_PAUSES ? lgc.pause_count : LGC_PAUSES;
+	double sorted[LGC_PAUSES];
+	memcpy(sorted, lgc.pauses, sizeof(double) * count);
+	qsort(sorted, count, sizeof(double), lgc_compare_pauses);
+	
+	lval* v = lval_list(LVAL_QEXPR, 7);
+	v = lval_add(v, builtin_gc_stat("heap", lval_int(lmem.old_bytes)));
+	v = lval_add(v, builtin_gc_stat("nursery", lval_int(lmem.nursery_bytes)));
+	v = lval_add(v, builtin_gc_stat("minor", lval_int(lgc.minors)));
+	v = lval_add(v, builtin_gc_stat("major", lval_int(lgc.majors)));
+	v = lval_add(v, builtin_gc_stat("pause-p50", lval_float(lgc_pause_percentile(sorted, count, 50))));
+	v = lval_add(v, builtin_gc_stat("pause-p99", lval_float(lgc_pause_percentile(sorted, count, 99))));
+	v = lval_add(v, builtin_gc_stat("pause-max", lval_float(count ? sorted[count - 1] : 0)));
+	return v;
+}
+
+// Global environment
+//
+// def binds symbols to values here. Like the symbol table it is open
+// addressed with linear probing and kept at most half full. A slot holds
+// a symbol and where its value is in lenv.values, a list that only lenv
+// changes, so once it is old minor collections leave it alone however
+// many globals there are. Nothing is ever unbound.
+//
+// Every def bumps lenv.version. A place that looks the same symbol up
+// again and again, such as a LOP_GLOBAL, keeps an lcache of what it found,
+// which holds for as long as the version it was filled at is current.
+
+typedef struct {
+	lval* sym;
+	int value;
+} lenv_slot;
+
+__thread struct {
+	lenv_slot* slots;
+	int capacity;
+	int count;
+	lval* values;
+	unsigned int version;
+} lenv = { .version = 1 };
+
+// Find the slot holding sym, or the empty slot where it belongs. Symbol
+// ids are handed out in order, so multiplying by an odd constant spreads
+// them without collisions until the table wraps.
+lenv_slot* lenv_slot_of(lval* sym) {
+	unsigned int mask = lenv.capacity - 1;
+	unsigned int i = (unsigned int) sym->id * 2654435769u & mask;
+	while (lenv.slots[i].sym && lenv.slots[i].sym != sym) {
+		i = (i + 1) & mask;
+	}
+	return &lenv.slots[i];
+}
+
+void lenv_grow(void) {
+	lenv_slot* old = lenv.slots;
+	int old_capacity = lenv.capacity;
+	
+	lenv.capacity = old_capacity ? old_capacity * 2 : 64;
+	lenv.slots = calloc(lenv.capacity, sizeof(lenv_slot));
+	for (int i = 0; i < old_capacity; i++) {
+		if (old[i].sym) { *lenv_slot_of(old[i].sym) = old[i]; }
+	}
+	free(old);
+}
+
+// The value of sym, or NULL if it is unbound
+lval* lenv_get(lval* sym) {
+	if (lenv.capacity == 0) { return NULL; }
+	lenv_slot* slot = lenv_slot_of(sym);
+	return slot->sym ? lenv.values->cell[slot->value] : NULL;
+}
+
+void lenv_put(lval* sym, lval* v) {
+	if (2 * (lenv.count + 1) > lenv.capacity) { lenv_grow(); }
+	
+	lenv_slot* slot = lenv_slot_of(sym);
+	if (slot->sym) {
+		lenv.values->cell[slot->value] = v;
+		lgc_write(lenv.values, slot->value, 1);
+	} else {
+		slot->sym = sym;
+		slot->value = lenv.values->count;
+		lenv.values = lval_add(lenv.values, v);
+		lenv.count++;
+	}
+	lenv.version++;
+}
+
+// lenv_get(sym), through the cache c. Young values are left out of the
+// cache, as a minor collection would move them without it knowing.
+lval* lenv_cached(lcache* c, lval* sym) {
+	if (c->version == lenv.version) { return c->value; }
+	lval* v = lenv_get(sym);
+	if (v && (lval_is_immediate(v) || !(v->flags & LGC_YOUNG))) {
+		c->version = lenv.version;
+		c->value = v;
+	}
+	return v;
+}
+
+lval* lval_err_unbound(lval* sym) {
+	char message[200];
+	snprintf(message, sizeof(message), "Unbound symbol '%s'", sym->sym);
+	return lval_err(message);
+}
+
+// The value of sym, or an error if it is unbound
+lval* lenv_lookup(lval* sym) {
+	lval* v = lenv_get(sym);
+	return v ? v : lval_err_unbound(sym);
+}
+
+lval* builtin_def(lval** args, int n) {
+	LASSERT(args, n > 0 && lval_type(args[0]) == LVAL_QEXPR,
+	  "Function 'def' not passed a Q-expression");
+	
+	// Builtins are linked by the reader, so {+} holds the builtin rather
+	// than a symbol and cannot be redefined
+	lval* syms = args[0];
+	for (int i = 0; i < syms->count; i++) {
+		LASSERT(args, lval_type(syms->cell[i]) == LVAL_SYM,
+		  "Function 'def' cannot define non-symbol");
+	}
+	LASSERT(args, syms->count == n - 1,
+	  "Function 'def' passed incorrect number of values to symbols");
+	
+	for (int i = 0; i < syms->count; i++) { lenv_put(syms->cell[i], args[i + 1]); }
+	return lval_sexpr();
+}
+
+// Lambdas
+//
+// (\ {x y} {+ x y}) makes a lambda. Its variables are resolved when it is
+// made, rather than looked up by name each time they are used. The body
+// is copied with each formal replaced by an LVAL_LOCAL holding the slot
+// of that argument. Each variable of the lambda it is made in is replaced
+// by a slot for a copy of that variable's value, which the new lambda
+// keeps: closures are flat, so a body never looks further than its own
+// lambda. Slots number the arguments first and the captured values
+// after, and the evaluators leave the arguments where they are on the
+// stack, so calling a lambda binds nothing. Any other symbol is a global.
+//
+// Only the body's S-expressions are code. Its Q-expressions are data and
+// are left as they are, but one may be the body of a lambda made while
+// it runs, so the variables they name are captured too.
+
+// Where the variables of a lambda being made come from
+typedef struct {
+	lval* formals;
+	// The lambda it is made in and that lambda's arguments, if any
+	lval* outer;
+	lval** outer_args;
+	// The variables captured so far, and their values
+	lval_stack names;
+	lval_stack values;
+} lscope;
+
+// The value of the outer lambda's variable sym, or NULL
+lval* lscope_outer(lscope* sc, lval* sym) {
+	if (sc->outer == NULL) { return NULL; }
+	lval* formals = sc->outer->cell[LLAMBDA_FORMALS];
+	for (int i = 0; i < formals->count; i++) {
+		if (formals->cell[i] == sym) { return sc->outer_args[i]; }
+	}
+	lval* captured = sc->outer->cell[LLAMBDA_CAPTURED];
+	for (int i = 0; i < captured->count; i++) {
+		if (captured->cell[i] == sym) { return sc->outer->cell[LLAMBDA_CAPTURES + i]; }
+	}
+	return NULL;
+}
+
+// The slot of sym, capturing it if it is the outer lambda's, or -1 for
+// a global
+int lscope_slot(lscope* sc, lval* sym) {
+	int params = sc->formals->count;
+	for (int i = 0; i < params; i++) {
+		if (sc->formals->cell[i] == sym) { return i; }
+	}
+	for (int i = 0; i < sc->names.count; i++) {
+		if (sc->names.items[i] == sym) { return params + i; }
+	}
+	
+	lval* v = lscope_outer(sc, sym);
+	if (v == NULL) { return -1; }
+	lval_stack_reserve(&sc->names, 1);
+	lval_stack_reserve(&sc->values, 1);
+	sc->names.items[sc->names.count++] = sym;
+	sc->values.items[sc->values.count++] = v;
+	return params + sc->names.count - 1;
+}
+
+// Capture the variables named anywhere in the Q-expression q
+void lscope_capture_all(lscope* sc, lval* q) {
+	static __thread lwalk* open;
+	static __thread int cap;
+	int count = 0;
+	open = lgrow(open, &cap, count, sizeof(lwalk));
+	open[count++] = (lwalk) { q, 0 };
+	
+	while (count > 0) {
+		lwalk* w = &open[count - 1];
+		if (w->next == w->list->count) {
+			count--;
+			continue;
+		}
+		lval* x = w->list->cell[w->next++];
+		int type = lval_type(x);
+		if (type == LVAL_SYM) {
+			lscope_slot(sc, x);
+		} else if (type == LVAL_SEXPR || type == LVAL_QEXPR) {
+			open = lgrow(open, &cap, count, sizeof(lwalk));
+			open[count++] = (lwalk) { x, 0 };
+		}
+	}
+}
+
+lval* lval_local(int slot, lval* sym) {
+	lval* v = lval_new(LVAL_LOCAL, 0);
+	v->slot = slot;
+	v->sym = sym->sym;
+	return v;
+}
+
+// A list being copied by lscope_resolve
+typedef struct {
+	lval* list;
+	lval* copy;
+	int next;
+} lresolve_frame;
+
+// Copy body as an S-expression with its variables resolved
+lval* lscope_resolve(lscope* sc, lval* body) {
+	static __thread lresolve_frame* open;
+	static __thread int cap;
+	int count = 0;
+	open = lgrow(open, &cap, count, sizeof(lresolve_frame));
+	open[count++] = (lresolve_frame) { body, lval_list(LVAL_SEXPR, body->count), 0 };
+	
+	while (true) {
+		lresolve_frame* f = &open[count - 1];
+		if (f->next == f->list->count) {
+			lval* copy = f->copy;
+			if (--count == 0) { return copy; }
+			open[count - 1].copy = lval_add(open[count - 1].copy, copy);
+			continue;
+		}
+		
+		lval* x = f->list->cell[f->next++];
+		int type = lval_type(x);
+		if (type == LVAL_SEXPR) {
+			open = lgrow(open, &cap, count, sizeof(lresolve_frame));
+			open[count++] = (lresolve_frame) { x, lval_list(LVAL_SEXPR, x->count), 0 };
+			continue;
+		}
+		if (type == LVAL_SYM) {
+			int slot = lscope_slot(sc, x);
+			if (slot >= 0) { x = lval_local(slot, x); }
+		} else if (type == LVAL_QEXPR) {
+			lscope_capture_all(sc, x);
+		}
+		f->copy = lval_add(f->copy, x);
+	}
+}
+
+// Make a lambda inside the one whose arguments start at "locals" on the
+// stack, or at the top level if locals is -1. Nothing here collects, so
+// the values it captures need no rooting.
+lval* lval_lambda(lval* formals, lval* body, int locals) {
+	LASSERT(args, lval_type(formals) == LVAL_QEXPR,
+	  "Function '\\' not passed a Q-expression of formals");
+	for (int i = 0; i < formals->count; i++) {
+		LASSERT(args, lval_type(formals->cell[i]) == LVAL_SYM,
+		  "Function '\\' cannot take a non-symbol as a formal");
+	}
+	LASSERT(args, lval_type(body) == LVAL_QEXPR,
+	  "Function '\\' not passed a Q-expression body");
+	
+	static __thread lscope sc;
+	sc.formals = formals;
+	sc.outer = locals < 0 ? NULL : lvm.stack.items[locals - 1];
+	sc.outer_args = locals < 0 ? NULL : lvm.stack.items + locals;
+	sc.names.count = 0;
+	sc.values.count = 0;
+	lval* code = lscope_resolve(&sc, body);
+	lval* captured = lval_list_of(LVAL_QEXPR, sc.names.items, sc.names.count);
+	
+	lval* f = lval_list(LVAL_LAMBDA, LLAMBDA_CAPTURES + sc.values.count);
+	f = lval_add(f, formals);
+	f = lval_add(f, body);
+	f = lval_add(f, code);
+	f = lval_add(f, captured);
+	for (int i = 0; i < sc.values.count; i++) { f = lval_add(f, sc.values.items[i]); }
+	return f;
+}
+
+// The evaluators make lambdas themselves, to resolve them against the
+// lambda they are in, so this is only reached by a call they cannot
+lval* builtin_lambda(lval** args, int n) {
+	LASSERTARGS(n, 2, "\\");
+	return lval_lambda(args[0], args[1], -1);
+}
+
+bool lval_is_lambda_builtin(lval* f) {
+	return lval_type(f) == LVAL_BUILTIN && f->fn == builtin_lambda;
+}
+
+// NULL if the lambda f takes n arguments, otherwise the error
+lval* lval_lambda_arity(lval* f, int n) {
+	int params = f->cell[LLAMBDA_FORMALS]->count;
+	if (n == params) { return NULL; }
+	char message[200];
+	snprintf(message, sizeof(message), "Lambda passed %i arguments; expected %i", n, params);
+	return lval_err(message);
+}
+
+// The value in a slot of the lambda whose arguments start at "locals" on
+// the stack
+lval* lvm_local(int slot, int locals) {
+	lval* f = lvm.stack.items[locals - 1];
+	int params = f->cell[LLAMBDA_FORMALS]->count;
+	if (slot < params) { return lvm.stack.items[locals + slot]; }
+	return f->cell[LLAMBDA_CAPTURES + slot - params];
+}
+
+// Arithmetic
+//
+// Each operator has its own kernel, chosen once by calling its builtin:
+// larith is inlined into every one with op a constant, so the switches on
+// op compile away. A kernel folds the arguments left to right in a single
+// pass, on longs while they are integers and nothing overflows, then on
+// doubles from the first float, overflow or inexact division on, just as
+// if every argument had been a double from there. Numbers are immediates,
+// so nothing is allocated but the result.
+
+#if defined(__GNUC__)
+#define LARITH_INLINE static inline __attribute__((always_inline))
+#define larith_add(x, y, r) __builtin_add_overflow(x, y, r)
+#define larith_sub(x, y, r) __builtin_sub_overflow(x, y, r)
+#define larith_mul(x, y, r) __builtin_mul_overflow(x, y, r)
+#else
+#define LARITH_INLINE static inline
+
+// Set *r to x op y, or return true if it does not fit a long
+bool larith_add(long x, long y, long* r) {
+	if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y)) { return true; }
+	*r = x + y;
+	return false;
+}
+
+bool larith_sub(long x, long y, long* r) {
+	if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y)) { return true; }
+	*r = x - y;
+	return false;
+}
+
+bool larith_mul(long x, long y, long* r) {
+	bool overflow = x > 0 ?
+		(y > 0 ? x > LONG_MAX / y : y < LONG_MIN / x) :
+		(y > 0 ? x < LONG_MIN / y : x != 0 && y < LONG_MAX / x);
+	if (overflow) { return true; }
+	*r = x * y;
+	return false;
+}
+#endif
+
+// Outcomes of a step on integers
+enum { LARITH_OK, LARITH_FLOAT, LARITH_DIV_ZERO };
+
+// Set *r to x to the power y, by squaring
+int larith_pow(long x, long y, long* r) {
+	if (y < 0) { return x == 0 ? LARITH_DIV_ZERO : LARITH_FLOAT; }
+	long result = 1;
+	while (true) {
+		if ((y & 1) && larith_mul(result, x, &result)) { return LARITH_FLOAT; }
+		y >>= 1;
+		if (y == 0) { break; }
+		if (larith_mul(x, x, &x)) { return LARITH_FLOAT; }
+	}
+	*r = result;
+	return LARITH_OK;
+}
+
+// Set *r to x op y. LARITH_FLOAT means the result is not a long, so the
+// step has to be redone on doubles.
+LARITH_INLINE int larith_int_step(int op, long x, long y, long* r) {
+	switch (op) {
+		case LARITH_ADD: return larith_add(x, y, r) ? LARITH_FLOAT : LARITH_OK;
+		case LARITH_SUB: return larith_sub(x, y, r) ? LARITH_FLOAT : LARITH_OK;
+		case LARITH_MUL: return larith_mul(x, y, r) ? LARITH_FLOAT : LARITH_OK;
+		case LARITH_DIV:
+			if (y == 0) { return LARITH_DIV_ZERO; }
+			if (y == -1) { return larith_sub(0, x, r) ? LARITH_FLOAT : LARITH_OK; }
+			if (x % y != 0) { return LARITH_FLOAT; }
+			*r = x / y;
+			return LARITH_OK;
+		case LARITH_MOD:
+			if (y == 0) { return LARITH_DIV_ZERO; }
+			*r = y == -1 ? 0 : x % y;
+			return LARITH_OK;
+		case LARITH_MAX: *r = x < y ? y : x; return LARITH_OK;
+		case LARITH_MIN: *r = x > y ? y : x; return LARITH_OK;
+		case LARITH_POW: return larith_pow(x, y, r);
+	}
+	*r = x;
+	return LARITH_OK;
+}
+
+// Set *x to *x op y, or return false on division by zero
+LARITH_INLINE bool larith_float_step(int op, double* x, double y) {
+	switch (op) {
+		case LARITH_ADD: *x += y; break;
+		case LARITH_SUB: *x -= y; break;
+		case LARITH_MUL: *x *= y; break;
+		case LARITH_DIV:
+			if (y == 0) { return false; }
+			*x /= y;
+			break;
+		case LARITH_MOD:
+			if (y == 0) { return false; }
+			*x = fmod(*x, y);
+			break;
+		case LARITH_MAX: if (*x < y) { *x = y; } break;
+		case LARITH_MIN: if (*x > y) { *x = y; } break;
+		case LARITH_POW:
+			if (*x == 0 && y < 0) { return false; }
+			*x = pow(*x, y);
+			break;
+	}
+	return true;
+}
+
+// Whether v is an integer, and if so its value
+LARITH_INLINE bool larith_is_int(lval* v, long* x) {
+	if (lval_is_fixnum(v)) {
+		*x = lval_get_int(v);
+		return true;
+	}
+	if (lval_is_immediate(v) || v->type != LVAL_INT) { return false; }
+	*x = v->i;
+	return true;
+}
+
+// Division by zero at some argument before "from". Any argument that is
+// not a number or a vector is reported instead, wherever it is.
+lval* larith_div_zero(lval** args, int n, int from) {
+	for (int i = from; i < n; i++) {
+		int type = lval_type(args[i]);
+		if (type != LVAL_INT && type != LVAL_FLOAT && type != LVAL_I64VEC && type != LVAL_F64VEC) {
+			return lval_err("Cannot operate on non-number!");
+		}
+	}
+	return lval_err("Division by zero!");
+}
+
+lval* lvec_arith(lval** args, int n, int op);
+
+LARITH_INLINE lval* larith(lval** args, int n, int op) {
+	
+	LASSERT(args, n > 0, "Cannot operate on no numbers!");
+	
+	long xi;
+	double xf;
+	int i = 1;
+	if (larith_is_int(args[0], &xi)) {
+		
+		// Negation is the one unary operation
+		if (op == LARITH_SUB && n == 1) {
+			long r;
+			return larith_sub(0, xi, &r) ? lval_float(-(double) xi) : lval_int(r);
+		}
+		
+		for (; i < n; i++) {
+			long yi;
+			long r;
+			if (!larith_is_int(args[i], &yi)) { break; }
+			int step = larith_int_step(op, xi, yi, &r);
+			if (step == LARITH_FLOAT) { break; }
+			if (step == LARITH_DIV_ZERO) { return larith_div_zero(args, n, i + 1); }
+			xi = r;
+		}
+		if (i == n) { return lval_int(xi); }
+		xf = (double) xi;
+		
+	} else if (lval_is_double(args[0])) {
+		xf = lval_get_float(args[0]);
+		if (op == LARITH_SUB && n == 1) { xf = -xf; }
+	} else {
+		return lvec_arith(args, n, op);
+	}
+	
+	for (; i < n; i++) {
+		lval* y = args[i];
+		long yi;
+		double yf;
+		if (lval_is_double(y)) {
+			yf = lval_get_float(y);
+		} else if (larith_is_int(y, &yi)) {
+			yf = (double) yi;
+		} else {
+			return lvec_arith(args, n, op);
+		}
+		if (!larith_float_step(op, &xf, yf)) { return larith_div_zero(args, n, i + 1); }
+	}
+	return lval_float(xf);
+}
+
+lval* builtin_add(lval** args, int n) { return larith(args, n, LARITH_ADD); }
+lval* builtin_sub(lval** args, int n) { return larith(args, n, LARITH_SUB); }
+lval* builtin_mul(lval** args, int n) { return larith(args, n, LARITH_MUL); }
+lval* builtin_div(lval** args, int n) { return larith(args, n, LARITH_DIV); }
+lval* builtin_mod(lval** args, int n) { return larith(args, n, LARITH_MOD); }
+lval* builtin_max(lval** args, int n) { return larith(args, n, LARITH_MAX); }
+lval* builtin_min(lval** args, int n) { return larith(args, n, LARITH_MIN); }
+lval* builtin_pow(lval** args, int n) { return larith(args, n, LARITH_POW); }
+
+// Vectors
+//
+// A vector packs its numbers into the storage after the struct, as longs
+// (LVAL_I64VEC) or as doubles (LVAL_F64VEC), rather than holding a list
+// of lvals, so a batch of numbers can be worked through a few at a time.
+// Arithmetic broadcasts over vectors: element i of the result is what the
+// operator gives on element i of every vector argument and on the other
+// arguments as they are. A vector has one element type, so once any
+// element of an integer result overflows or divides inexactly the whole
+// result is made of doubles, and an error in any element is the result of
+// the whole call.
+//
+// The kernels take four elements at a time with GCC's vector extensions,
+// or one at a time on other compilers. On x86-64 they are built twice,
+// for AVX2 and for plain SSE2, and the loader picks whichever the CPU can
+// run. Either way sums are added up in the same lanes, so they come out
+// the same on every machine.
+
+#if defined(__GNUC__)
+#define LVEC_SIMD
+typedef double lvec_f64x4 __attribute__((vector_size(32), aligned(8)));
+typedef long lvec_i64x4 __attribute__((vector_size(32), aligned(8)));
+typedef unsigned long lvec_u64x4 __attribute__((vector_size(32), aligned(8)));
+
+// The lanes of b where mask m is set and of a elsewhere
+#define LVEC_SELECT(type, m, b, a) \
+	((type) (((lvec_i64x4) (b) & (m)) | ((lvec_i64x4) (a) & ~(m))))
+#define LVEC_ANY(m) (((m)[0] | (m)[1] | (m)[2] | (m)[3]) != 0)
+#endif
+
+// Choosing a clone at load time needs ifunc support, which glibc has
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define LVEC_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef LVEC_CLONES
+#define LVEC_CLONES
+#endif
+
+// Where a kernel's operands come from: both from vectors, or one of them
+// a single value that goes with every element of the other
+enum { LVEC_VV, LVEC_VS, LVEC_SV };
+
+// Functions lvec_map applies
+enum { LVEC_SQRT, LVEC_EXP, LVEC_LOG };
+
+#ifdef LVEC_SIMD
+// r = expr for a and b taken four elements at a time from x and y
+#define LVEC_F64_LOOP(expr) \
+	for (; i + 4 <= n; i += 4) { \
+		lvec_f64x4 a = shape == LVEC_SV ? xs : *(lvec_f64x4*) (x + i); \
+		lvec_f64x4 b = shape == LVEC_VS ? ys : *(lvec_f64x4*) (y + i); \
+		*(lvec_f64x4*) (r + i) = (expr); \
+	}
+
+// The same for longs. "body" sets c, and sets the sign bit of a lane of
+// "over" if that lane overflowed, in which case c is not stored.
+#define LVEC_I64_LOOP(body) \
+	for (; i + 4 <= n; i += 4) { \
+		lvec_i64x4 a = shape == LVEC_SV ? xs : *(lvec_i64x4*) (x + i); \
+		lvec_i64x4 b = shape == LVEC_VS ? ys : *(lvec_i64x4*) (y + i); \
+		lvec_i64x4 c; \
+		lvec_i64x4 over = { 0 }; \
+		body; \
+		if (LVEC_ANY(over < 0)) { break; } \
+		*(lvec_i64x4*) (r + i) = c; \
+	}
+#endif
+
+// r[i] = x[i] op y[i] for the n doubles, with x or y a single value if
+// shape says so. r may be x or y. Returns false on division by zero.
+LVEC_CLONES bool lvec_f64_op(int op, double* r, double* x, double* y, long n, int shape) {
+	long i = 0;
+#ifdef LVEC_SIMD
+	double x0 = shape == LVEC_SV ? x[0] : 0;
+	double y0 = shape == LVEC_VS ? y[0] : 0;
+	lvec_f64x4 xs = { x0, x0, x0, x0 };
+	lvec_f64x4 ys = { y0, y0, y0, y0 };
+	lvec_i64x4 zero = { 0 };
+	switch (op) {
+		case LARITH_ADD: LVEC_F64_LOOP(a + b); break;
+		case LARITH_SUB: LVEC_F64_LOOP(a - b); break;
+		case LARITH_MUL: LVEC_F64_LOOP(a * b); break;
+		case LARITH_DIV: LVEC_F64_LOOP((zero |= b == 0, a / b)); break;
+		case LARITH_MAX: LVEC_F64_LOOP(LVEC_SELECT(lvec_f64x4, a < b, b, a)); break;
+		case LARITH_MIN: LVEC_F64_LOOP(LVEC_SELECT(lvec_f64x4, a > b, b, a)); break;
+	}
+	if (LVEC_ANY(zero)) { return false; }
+#endif
+	
+	// The last few one at a time, and every element for % and ^
+	for (; i < n; i++) {
+		double v = x[shape == LVEC_SV ? 0 : i];
+		if (!larith_float_step(op, &v, y[shape == LVEC_VS ? 0 : i])) { return false; }
+		r[i] = v;
+	}
+	return true;
+}
+
+// r[i] = x[i] op y[i] for the n longs, shaped as for lvec_f64_op. Stops at
+// the first element whose step is not LARITH_OK, setting *done to its
+// index and returning the step; r is only written before it.
+LVEC_CLONES int lvec_i64_op(int op, long* r, long* x, long* y, long n, int shape, long* done) {
+	long i = 0;
+#ifdef LVEC_SIMD
+	long x0 = shape == LVEC_SV ? x[0] : 0;
+	long y0 = shape == LVEC_VS ? y[0] : 0;
+	lvec_i64x4 xs = { x0, x0, x0, x0 };
+	lvec_i64x4 ys = { y0, y0, y0, y0 };
+	switch (op) {
+		case LARITH_ADD:
+			LVEC_I64_LOOP(c = (lvec_i64x4) ((lvec_u64x4) a + (lvec_u64x4) b); over = (a ^ c) & (b ^ c));
+			break;
+		case LARITH_SUB:
+			LVEC_I64_LOOP(c = (lvec_i64x4) ((lvec_u64x4) a - (lvec_u64x4) b); over = (a ^ b) & (a ^ c));
+			break;
+		case LARITH_MAX: LVEC_I64_LOOP(c = LVEC_SELECT(lvec_i64x4, a < b, b, a)); break;
+		case LARITH_MIN: LVEC_I64_LOOP(c = LVEC_SELECT(lvec_i64x4, a > b, b, a)); break;
+	}
+#endif
+	
+	// From the block that overflowed, if any, and every element for the
+	// operators without a vector kernel
+	for (; i < n; i++) {
+		long v;
+		int step = larith_int_step(op, x[shape == LVEC_SV ? 0 : i], y[shape == LVEC_VS ? 0 : i], &v);
+		if (step != LARITH_OK) {
+			*done = i;
+			return step;
+		}
+		r[i] = v;
+	}
+	*done = n;
+	return LARITH_OK;
+}
+
+// Add up the eight lanes of a sum, in a fixed order
+double lvec_lanes(double* lane) {
+	return ((lane[0] + lane[4]) + (lane[1] + lane[5])) + ((lane[2] + lane[6]) + (lane[3] + lane[7]));
+}
+
+// Sum of the n doubles at x, or their dot product with y if y is not
+// NULL. Element i is added into lane i % 8.
+LVEC_CLONES double lvec_f64_dot(double* x, double* y, long n) {
+	double lane[8] = { 0 };
+	long i = 0;
+#ifdef LVEC_SIMD
+	lvec_f64x4 s0 = { 0 };
+	lvec_f64x4 s1 = { 0 };
+	if (y) {
+		for (; i + 8 <= n; i += 8) {
+			s0 += *(lvec_f64x4*) (x + i) * *(lvec_f64x4*) (y + i);
+			s1 += *(lvec_f64x4*) (x + i + 4) * *(lvec_f64x4*) (y + i + 4);
+		}
+	} else {
+		for (; i + 8 <= n; i += 8) {
+			s0 += *(lvec_f64x4*) (x + i);
+			s1 += *(lvec_f64x4*) (x + i + 4);
+		}
+	}
+	memcpy(lane, &s0, sizeof(s0));
+	memcpy(lane + 4, &s1, sizeof(s1));
+#endif
+	for (; i < n; i++) { lane[i % 8] += y ? x[i] * y[i] : x[i]; }
+	return lvec_lanes(lane);
+}
+
+// Sum of the n longs at x, in the same lanes. Returns false if any partial
+// sum overflows.
+LVEC_CLONES bool lvec_i64_sum(long* x, long n, long* sum) {
+	long lane[8] = { 0 };
+	long i = 0;
+#ifdef LVEC_SIMD
+	lvec_i64x4 s0 = { 0 };
+	lvec_i64x4 s1 = { 0 };
+	lvec_i64x4 over = { 0 };
+	for (; i + 8 <= n; i += 8) {
+		lvec_i64x4 a = *(lvec_i64x4*) (x + i);
+		lvec_i64x4 b = *(lvec_i64x4*) (x + i + 4);
+		lvec_i64x4 c = (lvec_i64x4) ((lvec_u64x4) s0 + (lvec_u64x4) a);
+		lvec_i64x4 d = (lvec_i64x4) ((lvec_u64x4) s1 + (lvec_u64x4) b);
+		over |= ((s0 ^ c) & (a ^ c)) | ((s1 ^ d) & (b ^ d));
+		s0 = c;
+		s1 = d;
+	}
+	if (LVEC_ANY(over < 0)) { return false; }
+	memcpy(lane, &s0, sizeof(s0));
+	memcpy(lane + 4, &s1, sizeof(s1));
+#endif
+	for (; i < n; i++) {
+		if (larith_add(lane[i % 8], x[i], &lane[i % 8])) { return false; }
+	}
+	for (int l = 0; l < 4; l++) {
+		if (larith_add(lane[l], lane[l + 4], &lane[l])) { return false; }
+	}
+	return !larith_add(lane[0], lane[1], &lane[0]) &&
+	       !larith_add(lane[2], lane[3], &lane[2]) &&
+	       !larith_add(lane[0], lane[2], sum);
+}
+
+// Sum of the n longs at x, in order, with the running total wrapping
+// around. Each wrap is counted, up for a positive one and down for a
+// negative one, and if they cancel out the wrapped total is the exact sum,
+// however the partial sums overflowed on the way.
+bool lvec_i64_sum_exact(long* x, long n, long* sum) {
+	unsigned long total = 0;
+	long wraps = 0;
+	for (long i = 0; i < n; i++) {
+		unsigned long next = total + (unsigned long) x[i];
+		if ((long) ((total ^ next) & ((unsigned long) x[i] ^ next)) < 0) { wraps += x[i] < 0 ? -1 : 1; }
+		total = next;
+	}
+	*sum = (long) total;
+	return wraps == 0;
+}
+
+// Dot product of the n longs at x and y. Returns false if any product or
+// partial sum overflows.
+bool lvec_i64_dot(long* x, long* y, long n, long* dot) {
+	long sum = 0;
+	for (long i = 0; i < n; i++) {
+		long p;
+		if (larith_mul(x[i], y[i], &p) || larith_add(sum, p, &sum)) { return false; }
+	}
+	*dot = sum;
+	return true;
+}
+
+// r[i] = sqrt(x[i]) for the n doubles. r may be x. There are no vector
+// extensions for sqrt, but SSE2 has one for two doubles.
+LVEC_CLONES void lvec_f64_sqrt(double* r, double* x, long n) {
+	long i = 0;
+#if defined(__SSE2__)
+	for (; i + 2 <= n; i += 2) { _mm_storeu_pd(r + i, _mm_sqrt_pd(_mm_loadu_pd(x + i))); }
+#endif
+	for (; i < n; i++) { r[i] = sqrt(x[i]); }
+}
+
+bool lval_is_vec(lval* v) {
+	int type = lval_type(v);
+	return type == LVAL_I64VEC || type == LVAL_F64VEC;
+}
+
+// Vector of n elements, all still to be set
+lval* lvec_new(int type, int n) {
+	lval* v = lval_new(type, sizeof(double) * n);
+	v->count = n;
+	v->f64 = (double*) (v + 1);
+	return v;
+}
+
+// Vector of the n numbers at "items": of longs if they are all integers,
+// otherwise of doubles
+lval* lvec_of(lval** items, int n) {
+	int type = LVAL_I64VEC;
+	for (int i = 0; i < n; i++) {
+		int t = lval_type(items[i]);
+		if (t == LVAL_FLOAT) {
+			type = LVAL_F64VEC;
+		} else if (t != LVAL_INT) {
+			return lval_err("Vector elements must be numbers!");
+		}
+	}
+	
+	lval* v = lvec_new(type, n);
+	for (int i = 0; i < n; i++) {
+		if (type == LVAL_I64VEC) {
+			v->i64[i] = lval_get_int(items[i]);
+		} else {
+			v->f64[i] = lval_get_num(items[i]);
+		}
+	}
+	return v;
+}
+
+// v as a vector of doubles. If "own", v is a vector the caller has just
+// made and is converted where it is.
+lval* lvec_to_f64(lval* v, bool own) {
+	if (v->type == LVAL_F64VEC) { return v; }
+	lval* r = own ? v : lvec_new(LVAL_F64VEC, v->count);
+	for (int i = 0; i < v->count; i++) { r->f64[i] = (double) v->i64[i]; }
+	r->type = LVAL_F64VEC;
+	return r;
+}
+
+// x op y for every element, where x or y or both are vectors of the same
+// length. If "own", x is a vector the caller has just made, which can
+// hold the result.
+lval* lvec_step(int op, lval* x, lval* y, bool own) {
+	bool xv = lval_is_vec(x);
+	bool yv = lval_is_vec(y);
+	int shape = xv && yv ? LVEC_VV : (xv ? LVEC_VS : LVEC_SV);
+	int n = xv ? x->count : y->count;
+	
+	long xi = 0;
+	long yi = 0;
+	bool ints = (xv ? x->type == LVAL_I64VEC : larith_is_int(x, &xi)) &&
+	            (yv ? y->type == LVAL_I64VEC : larith_is_int(y, &yi));
+	if (ints) {
+		long* xp = xv ? x->i64 : &xi;
+		long* yp = yv ? y->i64 : &yi;
+		lval* r = own ? x : lvec_new(LVAL_I64VEC, n);
+		long done;
+		int step = lvec_i64_op(op, r->i64, xp, yp, n, shape, &done);
+		if (step == LARITH_OK) { return r; }
+		if (step == LARITH_DIV_ZERO) { return lval_err("Division by zero!"); }
+		
+		// Some element is not a long, so the result is doubles: the ones
+		// before it are done, the rest are redone on doubles. If r is x,
+		// those elements of x are still there.
+		for (long i = 0; i < done; i++) { r->f64[i] = (double) r->i64[i]; }
+		for (long i = done; i < n; i++) {
+			double v = (double) xp[shape == LVEC_SV ? 0 : i];
+			if (!larith_float_step(op, &v, (double) yp[shape == LVEC_VS ? 0 : i])) {
+				return lval_err("Division by zero!");
+			}
+			r->f64[i] = v;
+		}
+		r->type = LVAL_F64VEC;
+		return r;
+	}
+	
+	double xf = 0;
+	double yf = 0;
+	if (xv) {
+		// A copy made to convert x is the caller's to reuse too
+		lval* f = lvec_to_f64(x, own);
+		own = own || f != x;
+		x = f;
+	} else {
+		xf = lval_get_num(x);
+	}
+	if (yv) {
+		y = lvec_to_f64(y, false);
+	} else {
+		yf = lval_get_num(y);
+	}
+	
+	lval* r = own ? x : lvec_new(LVAL_F64VEC, n);
+	if (!lvec_f64_op(op, r->f64, xv ? x->f64 : &xf, yv ? y->f64 : &yf, n, shape)) {
+		return lval_err("Division by zero!");
+	}
+	return r;
+}
+
+// larith on arguments that are not all numbers, broadcasting over any
+// vectors among them
+lval* lvec_arith(lval** args, int n, int op) {
+	int first = -1;
+	for (int i = 0; i < n; i++) {
+		if (lval_is_vec(args[i])) {
+			if (first < 0) {
+				first = i;
+			} else if (args[i]->count != args[first]->count) {
+				return lval_err("Vectors differ in length!");
+			}
+		} else if (lval_type(args[i]) != LVAL_INT && lval_type(args[i]) != LVAL_FLOAT) {
+			return lval_err("Cannot operate on non-number!");
+		}
+	}
+	
+	// Numbers before the first vector fold the same way for every element
+	lval* x = first > 1 ? larith(args, first, op) : args[0];
+	if (lval_type(x) == LVAL_ERR) { return x; }
+	
+	// Negation is the one unary operation. Multiplying by -1 is exact and
+	// keeps the sign of zero.
+	if (n == 1) { return op == LARITH_SUB ? lvec_step(LARITH_MUL, lval_int(-1), x, false) : x; }
+	
+	bool own = false;
+	for (int i = first > 1 ? first : 1; i < n; i++) {
+		x = lvec_step(op, x, args[i], own);
+		if (lval_type(x) == LVAL_ERR) { return x; }
+		own = lval_is_vec(x);
+	}
+	return x;
+}
+
+// sqrt, exp or log of a number, or of every element of a vector
+lval* lvec_map(lval** args, int n, char* name, int fn) {
+	LASSERTARGS(n, 1, name);
+	
+	lval* x = args[0];
+	int type = lval_type(x);
+	if (type == LVAL_INT || type == LVAL_FLOAT) {
+		double v = lval_get_num(x);
+		switch (fn) {
+			case LVEC_SQRT: return lval_float(sqrt(v));
+			case LVEC_EXP: return lval_float(exp(v));
+			case LVEC_LOG: return lval_float(log(v));
+		}
+	}
+	LASSERT(args, lval_is_vec(x), "Cannot operate on non-number!");
+	
+	// Work in place on a converted copy, or into a new vector
+	lval* r = lvec_to_f64(x, false);
+	double* from = r->f64;
+	if (r == x) { r = lvec_new(LVAL_F64VEC, x->count); }
+	switch (fn) {
+		case LVEC_SQRT: lvec_f64_sqrt(r->f64, from, r->count); break;
+		case LVEC_EXP: for (int i = 0; i < r->count; i++) { r->f64[i] = exp(from[i]); } break;
+		case LVEC_LOG: for (int i = 0; i < r->count; i++) { r->f64[i] = log(from[i]); } break;
+	}
+	return r;
+}
+
+lval* builtin_sqrt(lval** args, int n) { return lvec_map(args, n, "sqrt", LVEC_SQRT); }
+lval* builtin_exp(lval** args, int n) { return lvec_map(args, n, "exp", LVEC_EXP); }
+lval* builtin_log(lval** args, int n) { return lvec_map(args, n, "log", LVEC_LOG); }
+
+lval* builtin_vec(lval** args, int n) {
+	// (vec {1 2 3}) as well as (vec 1 2 3)
+	if (n == 1 && lval_type(args[0]) == LVAL_QEXPR) { return lvec_of(args[0]->cell, args[0]->count); }
+	return lvec_of(args, n);
+}
+
+lval* builtin_sum(lval** args, int n) {
+	LASSERTARGS(n, 1, "sum");
+	
+	LASSERT(args, lval_is_vec(args[0]),
+		"Function 'sum' requires a vector");
+	
+	lval* v = args[0];
+	if (v->type == LVAL_F64VEC) { return lval_float(lvec_f64_dot(v->f64, NULL, v->count)); }
+	long sum;
+	if (lvec_i64_sum(v->i64, v->count, &sum)) { return lval_int(sum); }
+	// A lane can overflow where the whole sum does not
+	if (lvec_i64_sum_exact(v->i64, v->count, &sum)) { return lval_int(sum); }
+	
+	// Too big for a long, so add them up as doubles instead, as + would
+	v = lvec_to_f64(v, false);
+	return lval_float(lvec_f64_dot(v->f64, NULL, v->count));
+}
+
+lval* builtin_dot(lval** args, int n) {
+	LASSERTARGS(n, 2, "dot");
+	
+	LASSERT(args, lval_is_vec(args[0]) && lval_is_vec(args[1]),
+		"Function 'dot' requires two vectors");
+	
+	LASSERT(args, args[0]->count == args[1]->count,
+		"Vectors differ in length!");
+	
+	lval* x = args[0];
+	lval* y = args[1];
+	long dot;
+	if (x->type == LVAL_I64VEC && y->type == LVAL_I64VEC && lvec_i64_dot(x->i64, y->i64, x->count, &dot)) {
+		return lval_int(dot);
+	}
+	x = lvec_to_f64(x, false);
+	y = lvec_to_f64(y, false);
+	return lval_float(lvec_f64_dot(x->f64, y->f64, x->count));
+}
+
+// Builtin registry
+//
+// builtins.def lists every builtin, and mkbuiltins generates builtins.h
+// from it at build time: lbuiltin_table, with each builtin in the slot a
+// perfect hash of its name picks. The reader looks names up there once
+// and puts the builtin itself into the tree in place of the symbol, so
+// evaluating a call is one indirect call through lbuiltins[i].fn.
+
+// Defined with the parallel evaluation they share the pool of
+lval* builtin_pmap(lval** args, int n);
+lval* builtin_pfilter(lval** args, int n);
+lval* builtin_preduce(lval** args, int n);
+lval* builtin_async(lval** args, int n);
+lval* builtin_await(lval** args, int n);
+lval* builtin_spawn(lval** args, int n);
+lval* builtin_chan(lval** args, int n);
+lval* builtin_send(lval** args, int n);
+lval* builtin_recv(lval** args, int n);
+lval* builtin_isolate(lval** args, int n);
+lval* builtin_post(lval** args, int n);
+lval* builtin_take(lval** args, int n);
+lval* builtin_self(lval** args, int n);
+lval* builtin_freeze(lval** args, int n);
+
+#include "builtins.h"
+
+// The builtin values, in the same slots as lbuiltin_table. Like interned
+// symbols they are never collected.
+lval lbuiltins[LBUILTIN_SLOTS];
+
+void lbuiltin_init(void) {
+	for (int i = 0; i < LBUILTIN_SLOTS; i++) {
+		if (lbuiltin_table[i].name == NULL) { continue; }
+		lbuiltins[i].type = LVAL_BUILTIN;
+		lbuiltins[i].flags = LVAL_INTERNED;
+		lbuiltins[i].name = lbuiltin_table[i].name;
+		lbuiltins[i].fn = lbuiltin_table[i].fn;
+	}
+}
+
+// The builtin called "name", or NULL
+lval* lbuiltin_find(char* name) {
+	unsigned int i = lbuiltin_hash(name);
+	if (lbuiltin_table[i].name == NULL || strcmp(lbuiltin_table[i].name, name) != 0) { return NULL; }
+	return &lbuiltins[i];
+}
+
+// Quickening
+//
+// Both evaluators rewrite a call in place once they see what it is called
+// on: item 0 of the S-expression goes from the builtin the reader linked
+// to a quickened form of it for arguments of those types, such as + on
+// fixnums or head on a Q-expression. A quickened form checks its guard,
+// then does the work directly, without the generic builtin's dispatch and
+// argument checks. If the guard fails it calls the generic builtin and
+// the call is rewritten back, to be quickened again by what comes next.
+//
+// A quickened form is a builtin of its own, with the same name, so it
+// prints and evaluates the same wherever the list it is in ends up.
+// Calls in stored Q-expressions keep their quickened forms, so evaluating
+// them again starts out quick. The VM compiles calls from the tree and
+// reads the builtin out of it on each call, so it sees the rewrites too.
+
+typedef struct {
+	lbuiltin generic;
+	lbuiltin fn;
+	// The guard
+	bool (*fits)(lval** args, int n);
+} lquick_entry;
+
+bool lquick_ints(lval** args, int n) {
+	for (int i = 0; i < n; i++) {
+		if (!lval_is_fixnum(args[i])) { return false; }
+	}
+	return n > 0;
+}
+
+bool lquick_floats(lval** args, int n) {
+	for (int i = 0; i < n; i++) {
+		if (!lval_is_double(args[i])) { return false; }
+	}
+	return n > 0;
+}
+
+bool lquick_list(lval** args, int n) {
+	return n == 1 && lval_type(args[0]) == LVAL_QEXPR && args[0]->count > 0;
+}
+
+bool lquick_qexpr(lval** args, int n) {
+	return n == 1 && lval_type(args[0]) == LVAL_QEXPR;
+}
+
+lval* lquick_miss(lbuiltin generic, lval** args, int n);
+
+// + - * on fixnums. Results too big for a long are left to larith.
+LARITH_INLINE lval* lquick_int(lval** args, int n, int op, lbuiltin generic) {
+	if (!lquick_ints(args, n)) { return lquick_miss(generic, args, n); }
+	long x = lval_get_int(args[0]);
+	if (n == 1) { return op == LARITH_SUB ? lval_int(-x) : args[0]; }
+	for (int i = 1; i < n; i++) {
+		long r;
+		if (larith_int_step(op, x, lval_get_int(args[i]), &r) != LARITH_OK) { return generic(args, n); }
+		x = r;
+	}
+	return lval_int(x);
+}
+
+// + - * / on doubles. Division by zero is left to larith to report.
+LARITH_INLINE lval* lquick_float(lval** args, int n, int op, lbuiltin generic) {
+	if (!lquick_floats(args, n)) { return lquick_miss(generic, args, n); }
+	double x = lval_get_float(args[0]);
+	if (n == 1 && op == LARITH_SUB) { x = -x; }
+	for (int i = 1; i < n; i++) {
+		if (!larith_float_step(op, &x, lval_get_float(args[i]))) { return generic(args, n); }
+	}
+	return lval_float(x);
+}
+
+lval* lquick_int_add(lval** args, int n) { return lquick_int(args, n, LARITH_ADD, builtin_add); }
+lval* lquick_int_sub(lval** args, int n) { return lquick_int(args, n, LARITH_SUB, builtin_sub); }
+lval* lquick_int_mul(lval** args, int n) { return lquick_int(args, n, LARITH_MUL, builtin_mul); }
+lval* lquick_float_add(lval** args, int n) { return lquick_float(args, n, LARITH_ADD, builtin_add); }
+lval* lquick_float_sub(lval** args, int n) { return lquick_float(args, n, LARITH_SUB, builtin_sub); }
+lval* lquick_float_mul(lval** args, int n) { return lquick_float(args, n, LARITH_MUL, builtin_mul); }
+lval* lquick_float_div(lval** args, int n) { return lquick_float(args, n, LARITH_DIV, builtin_div); }
+
+lval* lquick_head(lval** args, int n) {
+	if (!lquick_list(args, n)) { return lquick_miss(builtin_head, args, n); }
+	lval* v = lval_list(LVAL_QEXPR, 1);
+	return lval_add(v, args[0]->cell[0]);
+}
+
+lval* lquick_tail(lval** args, int n) {
+	if (!lquick_list(args, n)) { return lquick_miss(builtin_tail, args, n); }
+	return lval_slice(args[0], 1, args[0]->count - 1);
+}
+
+lval* lquick_len(lval** args, int n) {
+	if (!lquick_qexpr(args, n)) { return lquick_miss(builtin_len, args, n); }
+	return lval_int(args[0]->count);
+}
+
+lquick_entry lquick_table[] = {
+	{ builtin_add, lquick_int_add, lquick_ints },
+	{ builtin_add, lquick_float_add, lquick_floats },
+	{ builtin_sub, lquick_int_sub, lquick_ints },
+	{ builtin_sub, lquick_float_sub, lquick_floats },
+	{ builtin_mul, lquick_int_mul, lquick_ints },
+	{ builtin_mul, lquick_float_mul, lquick_floats },
+	{ builtin_div, lquick_float_div, lquick_floats },
+	{ builtin_head, lquick_head, lquick_list },
+	{ builtin_tail, lquick_tail, lquick_list },
+	{ builtin_len, lquick_len, lquick_qexpr },
+};
+
+#define LQUICK_COUNT (int) (sizeof(lquick_table) / sizeof(lquick_table[0]))
+
+struct {
+	// The quickened builtins, in the order of lquick_table, and the
+	// generic builtin each stands in for
+	lval nodes[LQUICK_COUNT];
+	lval* generic[LQUICK_COUNT];
+	// Leave calls as they are, see --no-quicken
+	bool off;
+} lquick;
+
+// Set by a quickened builtin whose guard failed
+__thread bool lquick_missed;
+
+lval* lquick_miss(lbuiltin generic, lval** args, int n) {
+	lquick_missed = true;
+	return generic(args, n);
+}
+
+void lquick_init(void) {
+	for (int i = 0; i < LQUICK_COUNT; i++) {
+		lval* g = NULL;
+		for (int j = 0; j < LBUILTIN_SLOTS && !g; j++) {
+			if (lbuiltin_table[j].fn == lquick_table[i].generic) { g = &lbuiltins[j]; }
+		}
+		g->flags |= LVAL_QUICKENS;
+		lquick.generic[i] = g;
+		lquick.nodes[i] = (lval) { .type = LVAL_BUILTIN, .flags = LVAL_INTERNED | LVAL_QUICK };
+		lquick.nodes[i].name = g->name;
+		lquick.nodes[i].fn = lquick_table[i].fn;
+	}
+}
+
+// The builtin f stands in for, which is f itself unless it is quickened
+lval* lquick_generic(lval* f) {
+	if (lval_is_immediate(f) || !(f->flags & LVAL_QUICK)) { return f; }
+	return lquick.generic[f - lquick.nodes];
+}
+
+bool liso_is_main(void);
+bool liso_started(void);
+
+void lquick_rewrite(lval* e, lval* f) {
+	// Frozen code can be running in other isolates at the same time
+	if ((e->flags & LVAL_HASHED) && liso_started()) { return; }
+	e->cell[0] = f;
+	lgc_write(e, 0, 1);
+}
+
+// Call the builtin f, item 0 of the S-expression e, on args, rewriting e
+// for what they are
+lval* lquick_call(lval* e, lval* f, lval** args, int n) {
+	if (f->flags & LVAL_QUICK) {
+		lquick_missed = false;
+		lval* r = f->fn(args, n);
+		if (lquick_missed) { lquick_rewrite(e, lquick_generic(f)); }
+		return r;
+	}
+	if ((f->flags & LVAL_QUICKENS) && !lquick.off) {
+		for (int i = 0; i < LQUICK_COUNT; i++) {
+			if (lquick_table[i].generic == f->fn && lquick_table[i].fits(args, n)) {
+				lquick_rewrite(e, &lquick.nodes[i]);
+				return lquick_table[i].fn(args, n);
+			}
+		}
+	}
+	return f->fn(args, n);
+}
+
+// Constant folding
+//
+// Before a line is evaluated, calls to pure builtins whose arguments are
+// all constants are replaced by their results, innermost first, so
+// (+ 1 2 (* 3 4)) is evaluated as 15. Q-expressions are data until they
+// are evaluated, so nothing inside one is folded, lambda bodies included.
+// A call that fails is left as it is, to fail the same way when it is
+// evaluated, after whatever comes before it.
+
+// Whether v evaluates to itself
+bool lfold_is_const(lval* v) {
+	switch (lval_type(v)) {
+		case LVAL_INT: case LVAL_FLOAT: case LVAL_QEXPR: case LVAL_BUILTIN:
+		case LVAL_I64VEC: case LVAL_F64VEC:
+			return true;
+	}
+	return false;
+}
+
+// Whether v is a call to a pure builtin on constants
+bool lfold_is_pure_call(lval* v) {
+	if (v->count == 0 || lval_type(v->cell[0]) != LVAL_BUILTIN) { return false; }
+	if (!lbuiltin_table[lquick_generic(v->cell[0]) - lbuiltins].pure) { return false; }
+	for (int i = 1; i < v->count; i++) {
+		if (!lfold_is_const(v->cell[i])) { return false; }
+	}
+	return true;
+}
+
+// Fold the calls in v that can be, adding how many were to *folded, and
+// return what v is now. Like the compiler it walks the S-expressions from
+// a stack of the ones still open.
+lval* lfold(lval* v, int* folded) {
+	if (lval_type(v) != LVAL_SEXPR) { return v; }
+	
+	static __thread lwalk* open;
+	static __thread int cap;
+	int count = 0;
+	open = lgrow(open, &cap, count, sizeof(lwalk));
+	open[count++] = (lwalk) { v, 0 };
+	
+	while (true) {
+		lwalk* w = &open[count - 1];
+		if (w->next < w->list->count) {
+			lval* x = w->list->cell[w->next++];
+			if (lval_type(x) == LVAL_SEXPR) {
+				open = lgrow(open, &cap, count, sizeof(lwalk));
+				open[count++] = (lwalk) { x, 0 };
+			}
+			continue;
+		}
+		
+		lval* x = w->list;
+		if (lfold_is_pure_call(x)) {
+			lval* r = x->cell[0]->fn(&x->cell[1], x->count - 1);
+			if (lfold_is_const(r)) {
+				x = r;
+				(*folded)++;
+			}
+		}
+		if (--count == 0) { return x; }
+		
+		// Put the result in place of the call in the list it is in
+		w = &open[count - 1];
+		if (x != w->list->cell[w->next - 1]) {
+			w->list->cell[w->next - 1] = x;
+			lgc_write(w->list, w->next - 1, 1);
+		}
+	}
+}
+
+// Memoization
+//
+// With --memo, the value of an S-expression that calls a pure builtin on
+// constants and on other such calls, or evaluates a Q-expression made
+// only of those, is kept in a cache keyed by its structure, so the next
+// evaluation of the same structure takes a lookup. Keys are hashed and
+// compared with lval_hash and lval_equal, which for shared nodes is
+// constant time, so --memo also turns on --hash-cons. Either evaluator
+// checks the outermost S-expression it starts on and each Q-expression
+// it evaluates, walking them if they are not shared, and below those
+// only shared S-expressions, whose purity is worked out once when they
+// are made. Inside an S-expression that is being memoized nothing else
+// is, as its one entry covers them.
+//
+// Entries hold their key and value in slots 2i and 2i + 1 of a root
+// stack. They are chained from a bucket array by hash and kept on a list
+// from most to least recently used, the least recently used being
+// evicted whenever the entries take more than the budget. Errors are
+// never kept.
+
+#define LMEMO_BUDGET (16 * 1024 * 1024)
+
+typedef struct {
+	uint64_t hash;
+	size_t bytes;
+	// Neighbours on the list by use, and the next entry in the bucket or
+	// on the free list, or -1
+	int prev;
+	int next;
+	int chain;
+} lmemo_entry;
+
+__thread struct {
+	bool on;
+	size_t budget;
+	size_t bytes;
+	lmemo_entry* entries;
+	int entry_cap;
+	int count;
+	int free;
+	int* buckets;
+	int bucket_count;
+	int newest;
+	int oldest;
+	lval_stack values;
+	// Keys of the S-expressions being evaluated whose values are to be
+	// kept once they have them
+	lval_stack pending;
+	// Whether the S-expression the VM is about to compile, the body of
+	// an eval, has been looked up already, or is inside one being
+	// memoized and so is not to be
+	bool looked;
+	bool inside;
+	long hits;
+	long misses;
+	long evictions;
+} lmemo = { .budget = LMEMO_BUDGET, .free = -1, .newest = -1, .oldest = -1 };
+
+// Whether evaluating the items of v as an S-expression is a call to a
+// pure builtin on constants and such calls, or an eval of a Q-expression
+// that is, so its value depends only on its structure. No such value can
+// be a builtin, so one on its own is never called. Only the S-expressions
+// that are not shared are walked. With "locals", v may also use the
+// slots of a lambda it is the body of, whose values it then depends on.
+bool lmemo_is_pure_in(lval* v, bool locals) {
+	static __thread lval** open;
+	static __thread int cap;
+	int count = 0;
+	open = lgrow(open, &cap, count, sizeof(lval*));
+	open[count++] = v;
+	
+	while (count > 0) {
+		lval* l = open[--count];
+		if (lval_is_hashed(l)) {
+			if (!lhcons_node_of(l)->pure) { return false; }
+			continue;
+		}
+		// A single S-expression, as a line often is, has its value
+		if (l->count == 1 && lval_type(l->cell[0]) == LVAL_SEXPR) {
+			open[count++] = l->cell[0];
+			continue;
+		}
+		if (l->count == 0 || lval_type(l->cell[0]) != LVAL_BUILTIN) { return false; }
+		lval* f = lquick_generic(l->cell[0]);
+		bool eval = f->fn == builtin_eval && l->count == 2;
+		if (!eval && !lbuiltin_table[f - lbuiltins].pure) { return false; }
+		
+		for (int i = 1; i < l->count; i++) {
+			lval* x = l->cell[i];
+			int type = lval_type(x);
+			if (type == LVAL_SYM || (type == LVAL_LOCAL && !locals) || type == LVAL_LAMBDA || type == LVAL_ERR) {
+				return false;
+			}
+			// Q-expressions are data, unless eval runs them
+			if (type == LVAL_SEXPR || (type == LVAL_QEXPR && eval)) {
+				open = lgrow(open, &cap, count, sizeof(lval*));
+				open[count++] = x;
+			}
+		}
+		if (eval && lval_type(l->cell[1]) != LVAL_QEXPR) { return false; }
+	}
+	return true;
+}
+
+bool lmemo_is_pure(lval* v) {
+	return lmemo_is_pure_in(v, false);
+}
+
+// Roughly the bytes the heap holds for v: interned and immediate values
+// are left out, and lists sharing cells are each counted in full
+size_t lmemo_size(lval* v) {
+	static __thread lval** open;
+	static __thread int cap;
+	int count = 0;
+	size_t size = 0;
+	open = lgrow(open, &cap, count, sizeof(lval*));
+	open[count++] = v;
+	
+	while (count > 0) {
+		lval* x = open[--count];
+		if (lval_is_immediate(x) || (x->flags & LVAL_INTERNED)) { continue; }
+		size += lval_size(x);
+		if (!lgc_is_list(x)) { continue; }
+		if (x->cells) { size += lcells_size(x->cells); }
+		for (int i = 0; i < x->count; i++) {
+			open = lgrow(open, &cap, count, sizeof(lval*));
+			open[count++] = x->cell[i];
+		}
+	}
+	return size;
+}
+
+void lmemo_unlink(int i) {
+	lmemo_entry* e = &lmemo.entries[i];
+	if (e->prev >= 0) { lmemo.entries[e->prev].next = e->next; } else { lmemo.newest = e->next; }
+	if (e->next >= 0) { lmemo.entries[e->next].prev = e->prev; } else { lmemo.oldest = e->prev; }
+}
+
+void lmemo_link(int i) {
+	lmemo_entry* e = &lmemo.entries[i];
+	e->prev = -1;
+	e->next = lmemo.newest;
+	if (lmemo.newest >= 0) { lmemo.entries[lmemo.newest].prev = i; } else { lmemo.oldest = i; }
+	lmemo.newest = i;
+}
+
+int* lmemo_bucket(uint64_t hash) {
+	return &lmemo.buckets[hash & (lmemo.bucket_count - 1)];
+}
+
+// The value kept for the S-expression v, or NULL
+lval* lmemo_find(lval* v) {
+	if (lmemo.count == 0) {
+		lmemo.misses++;
+		return NULL;
+	}
+	uint64_t hash = lval_hash(v);
+	for (int i = *lmemo_bucket(hash); i >= 0; i = lmemo.entries[i].chain) {
+		if (lmemo.entries[i].hash == hash && lval_equal(lmemo.values.items[2 * i], v)) {
+			lmemo_unlink(i);
+			lmemo_link(i);
+			lmemo.hits++;
+			return lmemo.values.items[2 * i + 1];
+		}
+	}
+	lmemo.misses++;
+	return NULL;
+}
+
+void lmemo_evict(void) {
+	int i = lmemo.oldest;
+	lmemo_entry* e = &lmemo.entries[i];
+	int* link = lmemo_bucket(e->hash);
+	while (*link != i) { link = &lmemo.entries[*link].chain; }
+	*link = e->chain;
+	lmemo_unlink(i);
+	
+	lmemo.values.items[2 * i] = lval_int(0);
+	lmemo.values.items[2 * i + 1] = lval_int(0);
+	lmemo.bytes -= e->bytes;
+	e->chain = lmemo.free;
+	lmemo.free = i;
+	lmemo.count--;
+	lmemo.evictions++;
+}
+
+void lmemo_grow_buckets(void) {
+	free(lmemo.buckets);
+	lmemo.bucket_count = lmemo.bucket_count ? lmemo.bucket_count * 2 : 256;
+	lmemo.buckets = malloc(sizeof(int) * lmemo.bucket_count);
+	for (int i = 0; i < lmemo.bucket_count; i++) { lmemo.buckets[i] = -1; }
+	for (int i = lmemo.newest; i >= 0; i = lmemo.entries[i].next) {
+		int* b = lmemo_bucket(lmemo.entries[i].hash);
+		lmemo.entries[i].chain = *b;
+		*b = i;
+	}
+}
+
+// Keep r as the value of the S-expression v, unless it is an error or
+// too big for the budget on its own
+void lmemo_store(lval* v, lval* r) {
+	if (lval_type(r) == LVAL_ERR) { return; }
+	size_t bytes = sizeof(lmemo_entry) + lmemo_size(v) + lmemo_size(r);
+	if (bytes > lmemo.budget) { return; }
+	while (lmemo.count > 0 && lmemo.bytes + bytes > lmemo.budget) { lmemo_evict(); }
+	
+	int i = lmemo.free;
+	if (i >= 0) {
+		lmemo.free = lmemo.entries[i].chain;
+	} else {
+		i = lmemo.values.count / 2;
+		lmemo.entries = lgrow(lmemo.entries, &lmemo.entry_cap, i, sizeof(lmemo_entry));
+		lval_stack_reserve(&lmemo.values, 2);
+		lmemo.values.count += 2;
+	}
+	lmemo.values.items[2 * i] = v;
+	lmemo.values.items[2 * i + 1] = r;
+	lmemo.entries[i].hash = lval_hash(v);
+	lmemo.entries[i].bytes = bytes;
+	lmemo_link(i);
+	lmemo.bytes += bytes;
+	
+	if (++lmemo.count > lmemo.bucket_count) {
+		lmemo_grow_buckets();
+	} else {
+		int* b = lmemo_bucket(lmemo.entries[i].hash);
+		lmemo.entries[i].chain = *b;
+		*b = i;
+	}
+}
+
+// Whether to memoize v, an S-expression met inside the one an evaluator
+// started on, if nothing around it is
+bool lmemo_wants(lval* v) {
+	return lmemo.on && lval_is_hashed(v) && lmemo_is_pure(v);
+}
+
+// Note that the value of v is to be kept once it is known
+void lmemo_pend(lval* v) {
+	lval_stack_reserve(&lmemo.pending, 1);
+	lmemo.pending.items[lmemo.pending.count++] = v;
+}
+
+void lmemo_print_stats(void) {
+	printf(";; memo: %d entries (%zu of %zu bytes), %li hits, %li misses, %li evictions\n",
+	       lmemo.count, lmemo.bytes, lmemo.budget, lmemo.hits, lmemo.misses, lmemo.evictions);
+}
+
+// Whether an S-expression starting with v is a call. Symbols are, though
+// calling one that is not a builtin is an error. A lambda on its own is
+// its value unless it takes no arguments.
+bool lval_is_callable(lval* v) {
+	int type = lval_type(v);
+	if (type == LVAL_LAMBDA) { return v->cell[LLAMBDA_FORMALS]->count == 0; }
+	return type == LVAL_BUILTIN || type == LVAL_SYM;
+}
+
+// Call f, which should be a builtin, on the n arguments at "args"
+lval* lval_call(lval* f, lval** args, int n) {
+	switch (lval_type(f)) {
+		case LVAL_BUILTIN: return f->fn(args, n);
+		case LVAL_SYM: return lval_err("Unknown function");
+	}
+	return lval_err("S-expression does not start with a symbol!");
+}
+
+// Whether calling f on x is an eval the evaluator can do itself. Any
+// other call to eval goes to builtin_eval to report the error.
+bool lval_is_eval(lval* f, lval* x) {
+	return lval_type(f) == LVAL_BUILTIN && f->fn == builtin_eval && lval_type(x) == LVAL_QEXPR;
+}
+
+// Push a frame, or return false if there are already lvm.max_depth
+bool lvm_push_frame(lframe f) {
+	if (lvm.frame_count >= lvm.max_depth) { return false; }
+	lvm.frames = lgrow(lvm.frames, &lvm.frame_cap, lvm.frame_count, sizeof(lframe));
+	lvm.frames[lvm.frame_count++] = f;
+	return true;
+}
+
+lval* lval_err_depth(void) {
+	return lval_err("Evaluation nested too deeply!");
+}
+
+// Parallel evaluation
+//
+// With --parallel N, the items of an S-expression that are pure, in the
+// sense of lmemo_is_pure, and hold at least LPAR_MIN_COST cells are
+// evaluated as tasks on a pool of N threads, the evaluating thread among
+// them, if there are two or more. They are forked before the first item
+// is evaluated and joined as the evaluation comes to each, so the other
+// items run meanwhile and errors are met in the same order as before. A
+// pure item has no effects, so nothing else can tell.
+//
+// Tasks run lpar_eval, which does only what pure S-expressions need:
+// calls to builtins and eval of Q-expressions. It forks in the same way,
+// so a wide tree spreads over the pool. Each thread keeps the tasks it
+// forks on a Chase-Lev deque, running the newest itself while idle
+// threads steal the oldest, and a thread waiting on a task that was
+// stolen runs others until it is done. A thread that finds nothing to run
+// or steal yields a few times, then sleeps in lpar_idle until a task is
+// pushed, or one it waits on is done.
+//
+// Tasks allocate from arenas of their own thread, which the collector
+// never sees, and the only things they write to are what they allocate:
+// lval_reserve never extends a heap list's cells in place for them. The
+// main thread copies each result it joins into the heap, and once it has
+// joined everything it forked the arenas are emptied. Until then the
+// collector waits, as tasks read the heap and it would move things.
+//
+// pmap, pfilter and preduce share a list out over the same pool, with or
+// without --parallel, in chunks that are each a task. A task applies the
+// function to each item of its chunk. The function may be a pure builtin,
+// a Q-expression of one and constants that the item is added to the end
+// of, or a lambda whose body is pure apart from its own slots, which
+// lpar_eval evaluates too. The chunks' results are merged in order in the
+// heap.
+//
+// async gives a future for a Q-expression. A pure one is frozen with
+// lhcons_freeze and becomes a task on the same deques, with an arena of
+// its own, so it reads nothing the collector moves and outlives the line
+// that made it. await runs tasks until the one it wants is done, then
+// copies its value, or its error, into the future.
+
+#define LPAR_MIN_COST 256
+#define LPAR_DEQUE_SIZE 4096
+#define LPAR_MAX_THREADS 256
+// pmap and the rest aim for this many chunks per thread, of at least
+// LPAR_MIN_CHUNK items
+#define LPAR_CHUNKS_PER_THREAD 4
+#define LPAR_MIN_CHUNK 1024
+// Times a thread with nothing to run yields and looks again before it
+// sleeps
+#define LPAR_SPINS 64
+
+enum { LPAR_EVAL, LPAR_MAP, LPAR_FILTER, LPAR_REDUCE, LPAR_ASYNC };
+
+// A task either evaluates expr, inside the lambda fn with its arguments at
+// "args" if there is one, or applies fn to each of the "count" items at
+// "args", as "kind" says. It allocates from "arena", or if that is NULL
+// from its thread's and may read the heap.
+typedef struct {
+	int kind;
+	lval* expr;
+	lval* fn;
+	lval** args;
+	int count;
+	lpar_arena* arena;
+	lval* result;
+	int done;
+} lpar_task;
+
+// What a future made by async is waiting on. Its expression is frozen
+// and its arena its own, so it neither reads the heap nor keeps the
+// arenas from being emptied, and can run for as long as it likes.
+typedef struct {
+	lpar_task task;
+	lpar_arena arena;
+} lpar_future;
+
+// Tasks forked by the thread that owns it, which pushes and pops at the
+// bottom while others steal from the top
+typedef struct {
+	long top;
+	long bottom;
+	lpar_task* slots[LPAR_DEQUE_SIZE];
+} lpar_deque;
+
+// A forked task, to be joined at the given item of the frame that forked
+// it. Those the VM forks have -1 for both, and are joined in order.
+typedef struct {
+	int frame;
+	int item;
+	lpar_task* task;
+} lpar_join;
+
+// A frame of lpar_eval, like lframe
+typedef struct {
+	lval* list;
+	int next;
+	int base;
+} lpar_frame;
+
+typedef struct {
+	pthread_t thread;
+	lpar_deque deque;
+	lpar_arena arena;
+	// lpar_eval's values and frames, and the tasks its frames are to join
+	lval_stack values;
+	lpar_frame* frames;
+	int frame_count;
+	int frame_cap;
+	lpar_join* joins;
+	int join_count;
+	int join_cap;
+	// Scratch for lpar_cost and lpar_pick
+	lval** walk;
+	int walk_cap;
+	int* picks;
+	int pick_cap;
+	unsigned int seed;
+	// lvm.max_depth of the thread that started the pool
+	int max_depth;
+} lpar_worker;
+
+struct {
+	int threads;
+	// workers[0] is the main thread, and there is room for
+	// LPAR_MAX_THREADS, so they never move
+	lpar_worker* workers;
+	// Threads asleep on "wake" until a task is pushed, and those asleep
+	// on "done" until one finishes or is pushed, see lpar_idle
+	int sleeping;
+	int waiting;
+	// Tasks forked and not yet done that read the heap
+	int reading;
+	// Futures still waiting on a task, by the slot their second cell
+	// holds, with the task. Free slots hold 0 and NULL, and are on "free".
+	lval_stack futures;
+	lpar_future** records;
+	int record_cap;
+	int* free;
+	int free_count;
+	int free_cap;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	long forked;
+	long stolen;
+} lpar;
+
+__thread lpar_worker* lpar_self;
+
+// Only the main isolate's heap is read by tasks, and lpar_self is only
+// the main worker on its thread
+bool lpar_busy(void) {
+	if (lpar.workers == NULL || lpar_self != &lpar.workers[0]) { return false; }
+	return lpar.workers[0].join_count > 0 || __atomic_load_n(&lpar.reading, __ATOMIC_ACQUIRE) > 0;
+}
+
+void lpar_push(lpar_deque* d, lpar_task* t) {
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	d->slots[b & (LPAR_DEQUE_SIZE - 1)] = t;
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+lpar_task* lpar_pop(lpar_deque* d) {
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+	if (t > b) {
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	lpar_task* task = d->slots[b & (LPAR_DEQUE_SIZE - 1)];
+	if (t == b) {
+		// The last task, which a thief may be taking too
+		if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			task = NULL;
+		}
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return task;
+}
+
+lpar_task* lpar_steal(lpar_deque* d) {
+	long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b) { return NULL; }
+	lpar_task* task = __atomic_load_n(&d->slots[t & (LPAR_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+	return task;
+}
+
+bool lpar_is_full(lpar_deque* d) {
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	return b - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >= LPAR_DEQUE_SIZE;
+}
+
+// A task to run: w's newest, or else another thread's oldest
+lpar_task* lpar_find(lpar_worker* w) {
+	lpar_task* t = lpar_pop(&w->deque);
+	if (t) { return t; }
+	int threads = __atomic_load_n(&lpar.threads, __ATOMIC_ACQUIRE);
+	w->seed = w->seed * 1103515245 + 12345;
+	int from = (w->seed >> 16) % threads;
+	for (int i = 0; i < threads; i++) {
+		lpar_worker* victim = &lpar.workers[(from + i) % threads];
+		if (victim == w) { continue; }
+		t = lpar_steal(&victim->deque);
+		if (t) {
+			__atomic_add_fetch(&lpar.stolen, 1, __ATOMIC_RELAXED);
+			return t;
+		}
+	}
+	return NULL;
+}
+
+// Whether any deque holds a task. Seen by a thread that has just said it
+// is asleep, or by one that has just pushed, at least one of the two
+// sees the other.
+bool lpar_has_work(void) {
+	int threads = __atomic_load_n(&lpar.threads, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < threads; i++) {
+		lpar_deque* d = &lpar.workers[i].deque;
+		if (__atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST) > __atomic_load_n(&d->top, __ATOMIC_SEQ_CST)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Wake the threads asleep in lpar_idle, after pushing a task or, with
+// "finished", after finishing one
+void lpar_notify(bool finished) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	bool sleeping = !finished && __atomic_load_n(&lpar.sleeping, __ATOMIC_RELAXED) > 0;
+	bool waiting = __atomic_load_n(&lpar.waiting, __ATOMIC_RELAXED) > 0;
+	if (!sleeping && !waiting) { return; }
+	pthread_mutex_lock(&lpar.lock);
+	if (sleeping) { pthread_cond_broadcast(&lpar.wake); }
+	if (waiting) { pthread_cond_broadcast(&lpar.done); }
+	pthread_mutex_unlock(&lpar.lock);
+}
+
+// For a thread that found nothing to run: yield, and after LPAR_SPINS of
+// those in a row, sleep until a task is pushed. A thread waiting for
+// *watch to become "until" also wakes when a task finishes, so it never
+// sleeps through what it is waiting for.
+void lpar_idle(int* spins, int* watch, int until) {
+	if (++*spins < LPAR_SPINS) {
+		sched_yield();
+		return;
+	}
+	*spins = 0;
+	int* count = watch ? &lpar.waiting : &lpar.sleeping;
+	pthread_mutex_lock(&lpar.lock);
+	__atomic_add_fetch(count, 1, __ATOMIC_SEQ_CST);
+	while (!lpar_has_work() && !(watch && __atomic_load_n(watch, __ATOMIC_SEQ_CST) == until)) {
+		pthread_cond_wait(watch ? &lpar.done : &lpar.wake, &lpar.lock);
+	}
+	__atomic_sub_fetch(count, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&lpar.lock);
+}
+
+lval* lpar_eval(lpar_worker* w, lval* v, lval* fn, lval** args, bool fork);
+lval* lpar_chunk(lpar_worker* w, lpar_task* t);
+
+void lpar_run(lpar_worker* w, lpar_task* t) {
+	lpar_arena* saved = lpar_arena_now;
+	lpar_arena_now = t->arena ? t->arena : &w->arena;
+	switch (t->kind) {
+		case LPAR_EVAL: t->result = lpar_eval(w, t->expr, t->fn, t->args, true); break;
+		// Tasks it forked would allocate from their threads' arenas
+		case LPAR_ASYNC: t->result = lpar_eval(w, t->expr, NULL, NULL, false); break;
+		default: t->result = lpar_chunk(w, t);
+	}
+	lpar_arena_now = saved;
+	bool reading = t->arena == NULL;
+	__atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+	if (reading) { __atomic_sub_fetch(&lpar.reading, 1, __ATOMIC_ACQ_REL); }
+	lpar_notify(true);
+}
+
+// The result of t, running other tasks until it is done
+lval* lpar_wait(lpar_worker* w, lpar_task* t) {
+	int spins = 0;
+	while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+		lpar_task* other = lpar_find(w);
+		if (other) {
+			lpar_run(w, other);
+			spins = 0;
+		} else {
+			lpar_idle(&spins, &t->done, 1);
+		}
+	}
+	return t->result;
+}
+
+void* lpar_thread(void* arg) {
+	lpar_worker* w = arg;
+	lpar_self = w;
+	int spins = 0;
+	while (true) {
+		lpar_task* t = lpar_find(w);
+		if (t) {
+			lpar_run(w, t);
+			spins = 0;
+		} else {
+			lpar_idle(&spins, NULL, 0);
+		}
+	}
+	return NULL;
+}
+
+// Start the pool if need be, and grow it to "threads" threads counting
+// this one. It stops growing at the first thread that cannot be started,
+// and the threads it has are returned.
+int lpar_start(int threads) {
+	if (threads > LPAR_MAX_THREADS) { threads = LPAR_MAX_THREADS; }
+	if (lpar.workers == NULL) {
+		lpar.workers = calloc(LPAR_MAX_THREADS, sizeof(lpar_worker));
+		pthread_mutex_init(&lpar.lock, NULL);
+		pthread_cond_init(&lpar.wake, NULL);
+		pthread_cond_init(&lpar.done, NULL);
+		lpar_self = &lpar.workers[0];
+		lpar.workers[0].seed = 1;
+		lpar.workers[0].max_depth = lvm.max_depth;
+		lpar.threads = 1;
+		lgc_root_stack(&lpar.futures);
+	}
+	for (int i = lpar.threads; i < threads; i++) {
+		lpar.workers[i].seed = i + 1;
+		lpar.workers[i].max_depth = lvm.max_depth;
+		if (pthread_create(&lpar.workers[i].thread, NULL, lpar_thread, &lpar.workers[i]) != 0) { break; }
+		__atomic_store_n(&lpar.threads, i + 1, __ATOMIC_RELEASE);
+	}
+	return lpar.threads;
+}
+
+// Cells in the S-expression v, counting those of the Q-expressions it
+// evaluates, up to LPAR_MIN_COST
+int lpar_cost(lpar_worker* w, lval* v) {
+	int count = 0;
+	int cost = 0;
+	w->walk = lgrow(w->walk, &w->walk_cap, count, sizeof(lval*));
+	w->walk[count++] = v;
+	
+	while (count > 0 && cost < LPAR_MIN_COST) {
+		lval* l = w->walk[--count];
+		cost += l->count;
+		bool eval = l->count == 2 && lval_is_eval(l->cell[0], l->cell[1]);
+		for (int i = 0; i < l->count; i++) {
+			int type = lval_type(l->cell[i]);
+			if (type == LVAL_SEXPR || (type == LVAL_QEXPR && eval)) {
+				w->walk = lgrow(w->walk, &w->walk_cap, count, sizeof(lval*));
+				w->walk[count++] = l->cell[i];
+			}
+		}
+	}
+	return cost;
+}
+
+// Put in w->picks the items of l worth forking, returning how many. The
+// items of a list known to be pure need not be checked.
+int lpar_pick(lpar_worker* w, lval* l, bool pure) {
+	int picks = 0;
+	for (int i = 0; i < l->count; i++) {
+		lval* x = l->cell[i];
+		if (lval_type(x) != LVAL_SEXPR || lpar_cost(w, x) < LPAR_MIN_COST) { continue; }
+		if (!pure && !lmemo_is_pure(x)) { continue; }
+		w->picks = lgrow(w->picks, &w->pick_cap, picks, sizeof(int));
+		w->picks[picks++] = i;
+	}
+	return picks;
+}
+
+// A task made by w. Its memory is in w's arena, whoever ends up running
+// it.
+lpar_task* lpar_task_new(lpar_worker* w, int kind, lval* fn, lval** args, int count) {
+	lpar_task* t = lpar_alloc(&w->arena, sizeof(lpar_task));
+	*t = (lpar_task) { kind, NULL, fn, args, count, NULL, NULL, 0 };
+	return t;
+}
+
+// Put t on w's deque, or run it now if that is full
+void lpar_submit(lpar_worker* w, lpar_task* t) {
+	__atomic_add_fetch(&lpar.forked, 1, __ATOMIC_RELAXED);
+	if (t->arena == NULL) { __atomic_add_fetch(&lpar.reading, 1, __ATOMIC_ACQ_REL); }
+	if (lpar_is_full(&w->deque)) {
+		lpar_run(w, t);
+	} else {
+		lpar_push(&w->deque, t);
+		lpar_notify(false);
+	}
+}
+
+// Fork a task for x, inside the lambda fn if it is one, to be joined at
+// the given item of the given frame
+void lpar_spawn(lpar_worker* w, lval* x, lval* fn, lval** args, int frame, int item) {
+	lpar_task* t = lpar_task_new(w, LPAR_EVAL, fn, args, 0);
+	t->expr = x;
+	w->joins = lgrow(w->joins, &w->join_cap, w->join_count, sizeof(lpar_join));
+	w->joins[w->join_count++] = (lpar_join) { frame, item, t };
+	lpar_submit(w, t);
+}
+
+// Fork the items of l worth it, if there are two or more, for the frame
+// to join. They are forked last first, so the first is the next popped.
+void lpar_fork(lpar_worker* w, lval* l, lval* fn, lval** args, int frame, bool pure) {
+	int picks = lpar_pick(w, l, pure);
+	if (picks < 2) { return; }
+	for (int p = picks - 1; p >= 0; p--) {
+		lpar_spawn(w, l->cell[w->picks[p]], fn, args, frame, w->picks[p]);
+	}
+}
+
+// Whether the next task w is to join is the one for this item
+bool lpar_is_join(lpar_worker* w, int frame, int item) {
+	if (w->join_count == 0) { return false; }
+	lpar_join* j = &w->joins[w->join_count - 1];
+	return j->frame == frame && j->item == item;
+}
+
+bool lpar_in_arena(lval* v) {
+	if (lval_is_immediate(v) || (v->flags & (LVAL_INTERNED | LVAL_HASHED)) != LVAL_INTERNED) {
+		return false;
+	}
+	return v->type != LVAL_SYM && v->type != LVAL_BUILTIN;
+}
+
+// The value in a slot of the lambda fn, called on the arguments at "args"
+lval* lpar_local(lval* fn, lval** args, int slot) {
+	int params = fn->cell[LLAMBDA_FORMALS]->count;
+	if (slot < params) { return args[slot]; }
+	return fn->cell[LLAMBDA_CAPTURES + slot - params];
+}
+
+// Evaluate the items of the pure v as an S-expression on w, as the VM
+// would, inside the lambda fn called on the arguments at "args" if fn is
+// not NULL, and forking items worth it if "fork"
+lval* lpar_eval(lpar_worker* w, lval* v, lval* fn, lval** args, bool fork) {
+	int values = w->values.count;
+	int frames = w->frame_count;
+	int joins = w->join_count;
+	lval* r;
+	
+	w->frames = lgrow(w->frames, &w->frame_cap, w->frame_count, sizeof(lpar_frame));
+	w->frames[w->frame_count++] = (lpar_frame) { v, 0, values };
+	
+	while (true) {
+		lpar_frame* f = &w->frames[w->frame_count - 1];
+		if (fork && f->next == 0) { lpar_fork(w, f->list, fn, args, w->frame_count - 1, true); }
+		
+		if (f->next < f->list->count) {
+			int i = f->next++;
+			lval* x = f->list->cell[i];
+			if (lval_type(x) == LVAL_LOCAL) {
+				x = lpar_local(fn, args, x->slot);
+			} else if (lval_type(x) == LVAL_SEXPR) {
+				if (w->join_count > joins && lpar_is_join(w, w->frame_count - 1, i)) {
+					x = lpar_wait(w, w->joins[--w->join_count].task);
+					if (lval_type(x) == LVAL_ERR) {
+						r = x;
+						goto done;
+					}
+				} else {
+					if (w->frame_count - frames >= w->max_depth) {
+						r = lval_err_depth();
+						goto done;
+					}
+					w->frames = lgrow(w->frames, &w->frame_cap, w->frame_count, sizeof(lpar_frame));
+					w->frames[w->frame_count++] = (lpar_frame) { x, 0, w->values.count };
+					continue;
+				}
+			}
+			lval_stack_reserve(&w->values, 1);
+			w->values.items[w->values.count++] = x;
+			continue;
+		}
+		
+		lval** items = w->values.items + f->base;
+		int n = w->values.count - f->base;
+		if (n == 2 && lval_is_eval(items[0], items[1])) {
+			f->list = items[1];
+			f->next = 0;
+			w->values.count = f->base;
+			continue;
+		}
+		if (n == 0) {
+			r = lval_sexpr();
+		} else if (n == 1 && !lval_is_callable(items[0])) {
+			r = items[0];
+		} else if (lval_type(items[0]) != LVAL_BUILTIN || !lbuiltin_table[lquick_generic(items[0]) - lbuiltins].pure) {
+			// Only a lambda's argument, as the whole of its body, can be
+			// something else
+			r = lval_err("The pool can only call pure builtins");
+			goto done;
+		} else {
+			r = lval_call(lquick_generic(items[0]), items + 1, n - 1);
+			if (lval_type(r) == LVAL_ERR) { goto done; }
+		}
+		
+		w->values.count = f->base;
+		if (--w->frame_count == frames) { break; }
+		lval_stack_reserve(&w->values, 1);
+		w->values.items[w->values.count++] = r;
+	}
+	
+done:
+	// Tasks forked and not joined after an error can still be reading
+	// args, so they are seen to finish
+	while (w->join_count > joins) { lpar_wait(w, w->joins[--w->join_count].task); }
+	w->values.count = values;
+	w->frame_count = frames;
+	w->join_count = joins;
+	return r;
+}
+
+// Copy of v in the heap, for whatever of it is in an arena
+lval* lpar_copy_atom(lval* v) {
+	size_t size = lval_size(v);
+	lval* x = lval_new(v->type, size - sizeof(lval));
+	unsigned char flags = x->flags;
+	memcpy(x, v, size);
+	x->flags = flags;
+	if (x->type == LVAL_ERR) { x->err = (char*) (x + 1); }
+	if (lval_is_vec(x)) { x->f64 = (double*) (x + 1); }
+	return x;
+}
+
+lval* lpar_copy(lval* v) {
+	static __thread lval** open;
+	static __thread int cap;
+	int count = 0;
+	if (!lpar_in_arena(v)) { return v; }
+	if (!lgc_is_list(v)) { return lpar_copy_atom(v); }
+	
+	// Each list is copied with its cells as they are, then the cells that
+	// are in an arena are replaced by copies
+	lval* root = lval_list_of(v->type, v->cell, v->count);
+	open = lgrow(open, &cap, count, sizeof(lval*));
+	open[count++] = root;
+	while (count > 0) {
+		lval* l = open[--count];
+		for (int i = 0; i < l->count; i++) {
+			lval* x = l->cell[i];
+			if (!lpar_in_arena(x)) { continue; }
+			if (lgc_is_list(x)) {
+				x = lval_list_of(x->type, x->cell, x->count);
+				open = lgrow(open, &cap, count, sizeof(lval*));
+				open[count++] = x;
+			} else {
+				x = lpar_copy_atom(x);
+			}
+			l->cell[i] = x;
+		}
+	}
+	return root;
+}
+
+// Empty every thread's arena, once the main thread has joined all it
+// forked. Tasks left behind by an error are waited for first.
+void lpar_drain(void) {
+	lpar_worker* w = &lpar.workers[0];
+	int spins = 0;
+	while (__atomic_load_n(&lpar.reading, __ATOMIC_ACQUIRE) > 0) {
+		lpar_task* t = lpar_find(w);
+		if (t) {
+			lpar_run(w, t);
+			spins = 0;
+		} else {
+			lpar_idle(&spins, &lpar.reading, 0);
+		}
+	}
+	for (int i = 0; i < lpar.threads; i++) { lpar_arena_reset(&lpar.workers[i].arena); }
+}
+
+// On the main thread, join the next task, copying its result into the
+// heap. An error is returned as it is, and the caller stops.
+lval* lpar_join_next(void) {
+	lpar_worker* w = &lpar.workers[0];
+	lval* r = lpar_wait(w, w->joins[--w->join_count].task);
+	r = lpar_copy(r);
+	if (w->join_count == 0) { lpar_drain(); }
+	return r;
+}
+
+// On the main thread, give up joining the tasks forked since there were
+// "joins" to join, as the evaluation that forked them has stopped
+void lpar_leave(int joins) {
+	lpar_worker* w = &lpar.workers[0];
+	if (w->join_count <= joins) { return; }
+	w->join_count = joins;
+	if (joins == 0) { lpar_drain(); }
+}
+
+// How many S-expressions are in v, counting v, as ljit_mark numbers them
+int lpar_sexpr_count(lval* v) {
+	lpar_worker* w = &lpar.workers[0];
+	int count = 0;
+	int n = 0;
+	w->walk = lgrow(w->walk, &w->walk_cap, count, sizeof(lval*));
+	w->walk[count++] = v;
+	while (count > 0) {
+		lval* l = w->walk[--count];
+		n++;
+		for (int i = 0; i < l->count; i++) {
+			if (lval_type(l->cell[i]) != LVAL_SEXPR) { continue; }
+			w->walk = lgrow(w->walk, &w->walk_cap, count, sizeof(lval*));
+			w->walk[count++] = l->cell[i];
+		}
+	}
+	return n;
+}
+
+// Whether reducing with fn can be one call on each chunk and then one on
+// their results, as for builtin_op's associative operators
+bool lpar_is_assoc(lval* fn) {
+	if (lval_type(fn) != LVAL_BUILTIN) { return false; }
+	lbuiltin f = lquick_generic(fn)->fn;
+	return f == builtin_add || f == builtin_mul || f == builtin_max || f == builtin_min;
+}
+
+// fn applied on w to the n values at "args", which it must take, see
+// lpar_check_fn
+lval* lpar_apply(lpar_worker* w, lval* fn, lval** args, int n) {
+	if (lval_type(fn) == LVAL_LAMBDA) { return lpar_eval(w, fn->cell[LLAMBDA_CODE], fn, args, true); }
+	if (lval_type(fn) == LVAL_BUILTIN) { return lquick_generic(fn)->fn(args, n); }
+	
+	// The Q-expression's constants, then the arguments
+	int base = w->values.count;
+	int k = fn->count - 1;
+	lval_stack_reserve(&w->values, k + n);
+	memcpy(w->values.items + base, fn->cell + 1, sizeof(lval*) * k);
+	memcpy(w->values.items + base + k, args, sizeof(lval*) * n);
+	w->values.count += k + n;
+	lval* r = lquick_generic(fn->cell[0])->fn(w->values.items + base, k + n);
+	w->values.count = base;
+	return r;
+}
+
+// fn folded over the n values at "args" from the left
+lval* lpar_fold(lpar_worker* w, lval* fn, lval** args, int n) {
+	if (lpar_is_assoc(fn)) { return lpar_apply(w, fn, args, n); }
+	lval* acc = args[0];
+	for (int i = 1; i < n; i++) {
+		lval* pair[2] = { acc, args[i] };
+		acc = lpar_apply(w, fn, pair, 2);
+		if (lval_type(acc) == LVAL_ERR) { break; }
+	}
+	return acc;
+}
+
+// What a chunk task comes to: the list of fn's values for a map, of the
+// items it is true of for a filter, or the items folded for a reduce
+lval* lpar_chunk(lpar_worker* w, lpar_task* t) {
+	lval** items = t->args;
+	if (t->kind == LPAR_REDUCE) { return lpar_fold(w, t->fn, items, t->count); }
+	
+	lval* r = lval_list(LVAL_QEXPR, t->count);
+	for (int i = 0; i < t->count; i++) {
+		lval* x = lpar_apply(w, t->fn, &items[i], 1);
+		if (lval_type(x) == LVAL_ERR) { return x; }
+		if (t->kind == LPAR_FILTER) {
+			if (lval_type(x) != LVAL_INT && lval_type(x) != LVAL_FLOAT) {
+				return lval_err("Function 'pfilter' passed a function that did not return a number");
+			}
+			if (lval_get_num(x) == 0) { continue; }
+			x = items[i];
+		}
+		r->cell[r->count++] = x;
+	}
+	if (r->cells) { r->cells->end = r->count; }
+	return r;
+}
+
+// The error for a function that pmap and the rest cannot apply on the
+// pool to "arity" arguments, or NULL
+lval* lpar_check_fn(char* name, lval* fn, int arity) {
+	bool ok = false;
+	switch (lval_type(fn)) {
+		case LVAL_BUILTIN:
+			ok = lbuiltin_table[lquick_generic(fn) - lbuiltins].pure;
+			break;
+		case LVAL_QEXPR:
+			ok = fn->count > 0 && lval_type(fn->cell[0]) == LVAL_BUILTIN &&
+			     lbuiltin_table[lquick_generic(fn->cell[0]) - lbuiltins].pure;
+			for (int i = 1; ok && i < fn->count; i++) { ok = lfold_is_const(fn->cell[i]); }
+			break;
+		case LVAL_LAMBDA: {
+			// A body that is only a local or a constant is pure too
+			lval* code = fn->cell[LLAMBDA_CODE];
+			bool trivial = code->count == 0 ||
+			               (code->count == 1 && (lval_type(code->cell[0]) == LVAL_LOCAL || lfold_is_const(code->cell[0])));
+			ok = fn->cell[LLAMBDA_FORMALS]->count == arity && (trivial || lmemo_is_pure_in(code, true));
+			break;
+		}
+	}
+	if (ok) { return NULL; }
+	char message[200];
+	snprintf(message, sizeof(message),
+		"Function '%s' needs a pure builtin, or a Q-expression or lambda calling them", name);
+	return lval_err(message);
+}
+
+// Apply fn over the items of q in chunks on the pool, as "kind" says, and
+// merge the chunks' results in order into the heap. The first error, by
+// the order of the items, is the result if there is one.
+lval* lpar_chunked(int kind, lval* fn, lval* q) {
+	if (!liso_is_main()) { return lval_err("The pool can only be used by the main isolate"); }
+	lpar_start(1);
+	lpar_worker* w = &lpar.workers[0];
+	int n = q->count;
+	int size = n / (lpar.threads * LPAR_CHUNKS_PER_THREAD);
+	if (size < LPAR_MIN_CHUNK) { size = LPAR_MIN_CHUNK; }
+	// Any other reducer is folded over the items in order, in one chunk
+	if (kind == LPAR_REDUCE && !lpar_is_assoc(fn)) { size = n; }
+	int chunks = (n + size - 1) / size;
+	
+	lpar_task** tasks = malloc(sizeof(lpar_task*) * chunks);
+	for (int c = 0; c < chunks; c++) {
+		int count = n - c * size < size ? n - c * size : size;
+		tasks[c] = lpar_task_new(w, kind, fn, q->cell + c * size, count);
+	}
+	// Last first, so this thread starts on the first
+	for (int c = chunks - 1; c >= 0; c--) { lpar_submit(w, tasks[c]); }
+	
+	lval* err = NULL;
+	int total = 0;
+	for (int c = 0; c < chunks; c++) {
+		lval* x = lpar_wait(w, tasks[c]);
+		if (err == NULL && lval_type(x) == LVAL_ERR) { err = x; }
+		if (lval_type(x) == LVAL_QEXPR) { total += x->count; }
+	}
+	
+	lval* r;
+	if (err) {
+		r = lpar_copy(err);
+	} else if (kind == LPAR_REDUCE) {
+		// The chunks' values are folded where they are, like a task's
+		lval** parts = malloc(sizeof(lval*) * chunks);
+		for (int c = 0; c < chunks; c++) { parts[c] = tasks[c]->result; }
+		lpar_arena_now = &w->arena;
+		r = lpar_fold(w, fn, parts, chunks);
+		lpar_arena_now = NULL;
+		r = lpar_copy(r);
+		free(parts);
+	} else {
+		r = lval_list(LVAL_QEXPR, total);
+		for (int c = 0; c < chunks; c++) {
+			lval* x = tasks[c]->result;
+			for (int i = 0; i < x->count; i++) { r->cell[r->count++] = lpar_copy(x->cell[i]); }
+		}
+		if (r->cells) { r->cells->end = r->count; }
+		lgc_write(r, 0, r->count);
+	}
+	free(tasks);
+	if (w->join_count == 0) { lpar_drain(); }
+	return r;
+}
+
+lval* builtin_pmap(lval** args, int n) {
+	LASSERTARGS(n, 2, "pmap");
+	LASSERT(args, lval_type(args[1]) == LVAL_QEXPR,
+		"Function 'pmap' passed incorrect type.");
+	lval* err = lpar_check_fn("pmap", args[0], 1);
+	if (err) { return err; }
+	return lpar_chunked(LPAR_MAP, args[0], args[1]);
+}
+
+lval* builtin_pfilter(lval** args, int n) {
+	LASSERTARGS(n, 2, "pfilter");
+	LASSERT(args, lval_type(args[1]) == LVAL_QEXPR,
+		"Function 'pfilter' passed incorrect type.");
+	lval* err = lpar_check_fn("pfilter", args[0], 1);
+	if (err) { return err; }
+	return lpar_chunked(LPAR_FILTER, args[0], args[1]);
+}
+
+// With + * max or min, reduces in chunks and then over their values. Any
+// other fn is folded from the left, as it need not be associative.
+lval* builtin_preduce(lval** args, int n) {
+	LASSERTARGS(n, 2, "preduce");
+	LASSERT(args, lval_type(args[1]) == LVAL_QEXPR,
+		"Function 'preduce' passed incorrect type.");
+	LASSERT(args, args[1]->count != 0,
+		"Function 'preduce' passed {}!");
+	lval* err = lpar_check_fn("preduce", args[0], 2);
+	if (err) { return err; }
+	return lpar_chunked(LPAR_REDUCE, args[0], args[1]);
+}
+
+// A future, settled with v if slot is -1 and otherwise waiting on the
+// task in that slot
+lval* lpar_future_new(lval* v, int slot) {
+	lval* f = lval_list(LVAL_FUTURE, 2);
+	f = lval_add(f, v);
+	return lval_add(f, lval_int(slot));
+}
+
+int lpar_slot_new(void) {
+	if (lpar.free_count > 0) { return lpar.free[--lpar.free_count]; }
+	lval_stack_reserve(&lpar.futures, 1);
+	lpar.records = lgrow(lpar.records, &lpar.record_cap, lpar.futures.count, sizeof(lpar_future*));
+	lpar.records[lpar.futures.count] = NULL;
+	lpar.futures.items[lpar.futures.count] = lval_int(0);
+	return lpar.futures.count++;
+}
+
+// Copy the result of the done task in slot i into its future, and free
+// the slot and the task's arena
+void lpar_settle_slot(int i) {
+	lpar_future* record = lpar.records[i];
+	lval* f = lpar.futures.items[i];
+	f->cell[0] = lpar_copy(record->task.result);
+	f->cell[1] = lval_int(-1);
+	lgc_write(f, 0, 2);
+	lpar_arena_free(&record->arena);
+	free(record);
+	
+	lpar.records[i] = NULL;
+	lpar.futures.items[i] = lval_int(0);
+	lpar.free = lgrow(lpar.free, &lpar.free_cap, lpar.free_count, sizeof(int));
+	lpar.free[lpar.free_count++] = i;
+}
+
+// Settle the futures whose tasks are done, so futures that are never
+// awaited do not hold on to their arenas
+void lpar_settle(void) {
+	for (int i = 0; i < lpar.futures.count; i++) {
+		lpar_future* record = lpar.records[i];
+		if (record && __atomic_load_n(&record->task.done, __ATOMIC_ACQUIRE)) { lpar_settle_slot(i); }
+	}
+}
+
+// A pure expression is frozen and runs on the pool while the caller goes
+// on. Anything else could see or change the heap as it runs, so it is
+// evaluated now, and the future is settled from the start.
+lval* builtin_async(lval** args, int n) {
+	LASSERTARGS(n, 1, "async");
+	LASSERT(args, lval_type(args[0]) == LVAL_QEXPR,
+		"Function 'async' passed incorrect type.");
+	// The pool is the main isolate's
+	if (!liso_is_main()) { return lpar_future_new(builtin_eval(args, 1), -1); }
+	lpar_start(1);
+	lpar_settle();
+	
+	lval* q = lmemo_is_pure(args[0]) ? lhcons_freeze(args[0]) : NULL;
+	if (q == NULL) { return lpar_future_new(builtin_eval(args, 1), -1); }
+	
+	int slot = lpar_slot_new();
+	lpar_future* record = calloc(1, sizeof(lpar_future));
+	record->task = (lpar_task) { LPAR_ASYNC, q, NULL, NULL, 0, &record->arena, NULL, 0 };
+	lpar.records[slot] = record;
+	lval* f = lpar_future_new(lval_int(0), slot);
+	lpar.futures.items[slot] = f;
+	lpar_submit(&lpar.workers[0], &record->task);
+	return f;
+}
+
+// The value of a future, running tasks on this thread until it has one.
+// An error it settled with is returned as the error.
+lval* builtin_await(lval** args, int n) {
+	LASSERTARGS(n, 1, "await");
+	LASSERT(args, lval_type(args[0]) == LVAL_FUTURE,
+		"Function 'await' passed incorrect type.");
+	lval* f = args[0];
+	int slot = lval_get_int(f->cell[1]);
+	if (slot >= 0) {
+		lpar_wait(&lpar.workers[0], &lpar.records[slot]->task);
+		lpar_settle_slot(slot);
+	}
+	return f->cell[0];
+}
+
+void lpar_print_stats(void) {
+	printf(";; parallel: %d threads, %ld tasks forked, %ld stolen\n",
+		lpar.threads, lpar.forked, lpar.stolen);
+}
+
+// Green threads
+//
+// spawn starts a green thread on a Q-expression, which the tree walker
+// runs with a stack and frames of its own, swapped in while it runs. The
+// threads take turns, each for --slice steps of the walker or until it
+// has to wait, so no one of them holds up the rest for long. A channel is
+// a queue that any thread can send to or receive from. A green thread
+// that receives from an empty channel waits until something is sent to
+// one, and then makes the call again. On the main thread, or inside a
+// call made through another evaluator, recv runs the other green threads
+// until there is something to receive. The channel spawn gives
+// is sent the thread's value, or its error, when it ends.
+//
+// Green threads share the heap and the environment, so they take turns
+// on the thread that runs the interpreter, and heavy pure work still goes
+// to the pool through async. Memoizing and forking are off while they
+// run, as both keep state between frames that is not swapped.
+
+#define LGREEN_SLICE 1000
+
+typedef struct {
+	// Its channel, its expression and then its values, and its frames
+	lval_stack stack;
+	lframe* frames;
+	int frame_count;
+	int frame_cap;
+} lgreen_thread;
+
+__thread struct {
+	// Steps of the walker a thread runs for before the next has a turn,
+	// see --slice, and how many the running thread has left
+	int slice;
+	int steps;
+	// Threads that can run, in turn, as a ring starting at "head"
+	lgreen_thread** ready;
+	int head;
+	int count;
+	int cap;
+	// Threads waiting for something to be sent, and ended ones, whose
+	// stacks are kept rooted to reuse
+	lgreen_thread** waiting;
+	int waiting_count;
+	int waiting_cap;
+	lgreen_thread** spare;
+	int spare_count;
+	int spare_cap;
+	lgreen_thread* running;
+	// Whether the running thread stopped to wait rather than at the end
+	// of its slice
+	bool wait;
+	long spawned;
+	long turns;
+} lgreen = { .slice = LGREEN_SLICE };
+
+lval* lval_walk(int frames, int pending, bool green);
+
+void lgreen_ready(lgreen_thread* t) {
+	if (lgreen.count == lgreen.cap) {
+		int cap = lgreen.cap ? lgreen.cap * 2 : 64;
+		lgreen_thread** ready = malloc(sizeof(lgreen_thread*) * cap);
+		for (int i = 0; i < lgreen.count; i++) { ready[i] = lgreen.ready[(lgreen.head + i) % lgreen.cap]; }
+		free(lgreen.ready);
+		lgreen.ready = ready;
+		lgreen.cap = cap;
+		lgreen.head = 0;
+	}
+	lgreen.ready[(lgreen.head + lgreen.count++) % lgreen.cap] = t;
+}
+
+// Add v to the end of the channel c, and let the threads waiting try
+// again
+void lchan_send(lval* c, lval* v) {
+	// Once the block is full, the cells already taken make room rather
+	// than it growing
+	lcells* b = c->cells;
+	if (b && b->end == b->cap && b->start > 0) {
+		memmove(b->slot, c->cell, sizeof(lval*) * c->count);
+		c->cell = b->slot;
+		b->start = 0;
+		b->end = c->count;
+		lgc_write(c, 0, c->count);
+	}
+	lval_add(c, v);
+	for (int i = 0; i < lgreen.waiting_count; i++) { lgreen_ready(lgreen.waiting[i]); }
+	lgreen.waiting_count = 0;
+}
+
+// Take the first value from the channel c, which is not empty
+lval* lchan_take(lval* c) {
+	lval* x = c->cell[0];
+	c->count--;
+	if (c->cells) {
+		c->cell++;
+		c->cells->start++;
+	} else {
+		memmove(&c->cell[0], &c->cell[1], sizeof(lval*) * c->count);
+	}
+	return x;
+}
+
+// Swap t's stack and frames with the walker's
+void lgreen_swap(lgreen_thread* t) {
+	lval_stack stack = lvm.stack;
+	lvm.stack = t->stack;
+	t->stack = stack;
+	lframe* frames = lvm.frames;
+	lvm.frames = t->frames;
+	t->frames = frames;
+	int count = lvm.frame_count;
+	lvm.frame_count = t->frame_count;
+	t->frame_count = count;
+	int cap = lvm.frame_cap;
+	lvm.frame_cap = t->frame_cap;
+	t->frame_cap = cap;
+}
+
+// Give the next ready thread its turn. It goes back in line, or to wait,
+// or, once it has ended, its value goes to its channel.
+void lgreen_turn(void) {
+	lgreen_thread* t = lgreen.ready[lgreen.head];
+	lgreen.head = (lgreen.head + 1) % lgreen.cap;
+	lgreen.count--;
+	lgreen.turns++;
+	
+	bool memo = lmemo.on;
+	bool par = lvm.parallel;
+	lmemo.on = lvm.parallel = false;
+	lgreen.running = t;
+	lgreen.steps = lgreen.slice;
+	lgreen.wait = false;
+	lgreen_swap(t);
+	lval* r = lval_walk(0, lmemo.pending.count, true);
+	lgreen_swap(t);
+	lgreen.running = NULL;
+	lmemo.on = memo;
+	lvm.parallel = par;
+	
+	if (r == NULL && lgreen.wait) {
+		lgreen.waiting = lgrow(lgreen.waiting, &lgreen.waiting_cap, lgreen.waiting_count, sizeof(lgreen_thread*));
+		lgreen.waiting[lgreen.waiting_count++] = t;
+	} else if (r == NULL) {
+		lgreen_ready(t);
+	} else {
+		lval* c = t->stack.items[0];
+		t->stack.count = 0;
+		t->frame_count = 0;
+		lgreen.spare = lgrow(lgreen.spare, &lgreen.spare_cap, lgreen.spare_count, sizeof(lgreen_thread*));
+		lgreen.spare[lgreen.spare_count++] = t;
+		lchan_send(c, r);
+	}
+}
+
+// Whether the call of the n values at "items" is a recv that has to wait
+bool lgreen_must_wait(lval** items, int n) {
+	if (n != 2 || lval_type(items[0]) != LVAL_BUILTIN || lval_type(items[1]) != LVAL_CHAN) {
+		return false;
+	}
+	return lquick_generic(items[0])->fn == builtin_recv && items[1]->count == 0;
+}
+
+lval* builtin_spawn(lval** args, int n) {
+	LASSERTARGS(n, 1, "spawn");
+	LASSERT(args, lval_type(args[0]) == LVAL_QEXPR,
+		"Function 'spawn' passed incorrect type.");
+	lgreen_thread* t;
+	if (lgreen.spare_count > 0) {
+		t = lgreen.spare[--lgreen.spare_count];
+	} else {
+		t = calloc(1, sizeof(lgreen_thread));
+		lgc_root_stack(&t->stack);
+	}
+	lval_stack_reserve(&t->stack, 2);
+	t->stack.items[0] = lval_list(LVAL_CHAN, 0);
+	t->stack.items[1] = args[0];
+	t->stack.count = 2;
+	t->frames = lgrow(t->frames, &t->frame_cap, 0, sizeof(lframe));
+	t->frames[0] = (lframe) { 2, 0, -1, 1, false };
+	t->frame_count = 1;
+	lgreen_ready(t);
+	lgreen.spawned++;
+	return t->stack.items[0];
+}
+
+lval* builtin_chan(lval** args, int n) {
+	LASSERTARGS(n, 0, "chan");
+	return lval_list(LVAL_CHAN, 0);
+}
+
+lval* builtin_send(lval** args, int n) {
+	LASSERTARGS(n, 2, "send");
+	LASSERT(args, lval_type(args[0]) == LVAL_CHAN,
+		"Function 'send' passed incorrect type.");
+	lchan_send(args[0], args[1]);
+	return lval_sexpr();
+}
+
+// A green thread's recv waits in the walker, see lgreen_must_wait. One
+// made anywhere else, by the main thread or inside a call another
+// evaluator makes for a green thread, waits here by running the other
+// green threads, the one that made it keeping its place meanwhile.
+lval* builtin_recv(lval** args, int n) {
+	LASSERTARGS(n, 1, "recv");
+	LASSERT(args, lval_type(args[0]) == LVAL_CHAN,
+		"Function 'recv' passed incorrect type.");
+	lval* c = args[0];
+	lgreen_thread* running = lgreen.running;
+	int steps = lgreen.steps;
+	bool wait = lgreen.wait;
+	lgc_root(&c);
+	while (c->count == 0 && lgreen.count > 0) { lgreen_turn(); }
+	lgc_unroot(1);
+	lgreen.running = running;
+	lgreen.steps = steps;
+	lgreen.wait = wait;
+	if (c->count == 0) { return lval_err("Function 'recv' would wait forever"); }
+	return lchan_take(c);
+}
+
+void lgreen_print_stats(void) {
+	printf(";; green threads: %ld spawned, %ld turns, %d waiting\n",
+		lgreen.spawned, lgreen.turns, lgreen.waiting_count);
+}
+
+// Evaluate the items of v as an S-expression, whatever v's type, by
+// walking the tree. Each S-expression being evaluated has a frame, with
+// the S-expression on the stack and the values of its items after it, so
+// nesting takes no C stack. A call to eval takes over its S-expression's
+// frame rather than pushing one, as its result is that S-expression's. So
+// does a call to a lambda, which moves the lambda and its arguments to the
+// start of the frame and runs its body after them.
+//
+// A frame whose value is to be memoized has its key on lmemo.pending.
+// With --parallel, a frame forks its items that are worth it as it
+// starts, and joins each in its place, see "Parallel evaluation".
+lval* lval_eval_sexpr(lval* v) {
+	lval_stack* s = &lvm.stack;
+	int entry = s->count;
+	int frames = lvm.frame_count;
+	int pending = lmemo.pending.count;
+	int joins = lvm.parallel ? lpar.workers[0].join_count : 0;
+	lval* r;
+	
+	bool memo = lmemo.on && lmemo_is_pure(v);
+	if (memo) {
+		r = lmemo_find(v);
+		if (r) { return r; }
+		lmemo_pend(v);
+	}
+	lval_stack_reserve(s, 1);
+	s->items[s->count++] = v;
+	if (lvm_push_frame((lframe) { s->count, 0, -1, s->count - 1, memo })) {
+		r = lval_walk(frames, pending, false);
+	} else {
+		r = lval_err_depth();
+	}
+	
+	s->count = entry;
+	lvm.frame_count = frames;
+	lmemo.pending.count = pending;
+	if (lvm.parallel) { lpar_leave(joins); }
+	return r;
+}
+
+// Run the frames above the first "frames" to the end, for
+// lval_eval_sexpr. A green thread's walk stops part way with NULL when
+// its slice is used up or it has to wait, and is picked up from the same
+// frames later, see "Green threads".
+lval* lval_walk(int frames, int pending, bool green) {
+	lval_stack* s = &lvm.stack;
+	lval* r;
+	
+	while (true) {
+		if (green && --lgreen.steps < 0) { return NULL; }
+		lframe* f = &lvm.frames[lvm.frame_count - 1];
+		lval* e = s->items[f->base - 1];
+		if (lvm.parallel && f->next == 0) { lpar_fork(&lpar.workers[0], e, NULL, NULL, lvm.frame_count - 1, false); }
+		
+		// Evaluate the next item, giving the collector a chance to run
+		// before each S-expression
+		if (f->next < e->count) {
+			lval* x = e->cell[f->next++];
+			int type = lval_type(x);
+			if (type == LVAL_SYM) {
+				x = lenv_lookup(x);
+				type = lval_type(x);
+			} else if (type == LVAL_LOCAL) {
+				x = lvm_local(x->slot, f->locals);
+				type = lval_type(x);
+			}
+			if (type == LVAL_ERR) { return x; }
+			if (type == LVAL_SEXPR && lvm.parallel && lpar_is_join(&lpar.workers[0], lvm.frame_count - 1, f->next - 1)) {
+				x = lpar_join_next();
+				if (lval_type(x) == LVAL_ERR) { return x; }
+				lval_stack_reserve(s, 1);
+				s->items[s->count++] = x;
+				continue;
+			}
+			lval_stack_reserve(s, 1);
+			s->items[s->count++] = x;
+			if (type == LVAL_SEXPR) {
+				// A memoized value takes the place of the S-expression
+				bool memo = lmemo.pending.count == pending && lmemo_wants(x);
+				if (memo) {
+					lval* m = lmemo_find(x);
+					if (m) {
+						s->items[s->count - 1] = m;
+						continue;
+					}
+					lmemo_pend(x);
+				}
+				if (!lvm_push_frame((lframe) { s->count, 0, f->locals, s->count - 1, memo })) {
+					return lval_err_depth();
+				}
+				lgc_safepoint();
+			}
+			continue;
+		}
+		
+		// Every item has a value
+		lval** items = s->items + f->base;
+		int n = s->count - f->base;
+		if (n == 2 && lval_is_eval(items[0], items[1])) {
+			lval* q = items[1];
+			if (lmemo.on && lmemo.pending.count == pending && lmemo_is_pure(q)) {
+				r = lmemo_find(q);
+				if (r) { goto result; }
+				lmemo_pend(q);
+				f->memo = true;
+			}
+			s->items[f->base - 1] = q;
+			s->count = f->base;
+			f->next = 0;
+			lgc_safepoint();
+			continue;
+		}
+		if (n > 0 && lval_type(items[0]) == LVAL_LAMBDA && (n > 1 || lval_is_callable(items[0]))) {
+			lval* fn = items[0];
+			r = lval_lambda_arity(fn, n - 1);
+			if (r) { return r; }
+			
+			// Anything the frame held before is done with, so calls in tail
+			// position run in constant space
+			memmove(&s->items[f->top + 1], items, sizeof(lval*) * n);
+			s->count = f->top + 1 + n;
+			f->locals = f->top + 2;
+			lval_stack_reserve(s, 1);
+			s->items[s->count++] = fn->cell[LLAMBDA_CODE];
+			f->base = s->count;
+			f->next = 0;
+			lgc_safepoint();
+			continue;
+		}
+		// The call is made again when the green thread goes on
+		if (green && lgreen_must_wait(items, n)) {
+			lgreen.wait = true;
+			return NULL;
+		}
+		
+		if (n == 0) {
+			// Empty expression
+			r = lval_sexpr();
+		} else if (n == 1 && !lval_is_callable(items[0])) {
+			// Single expression, unless it is a function to call with no
+			// arguments
+			r = items[0];
+		} else if (n == 3 && lval_is_lambda_builtin(items[0])) {
+			r = lval_lambda(items[1], items[2], f->locals);
+			if (lval_type(r) == LVAL_ERR) { return r; }
+		} else if (lval_type(items[0]) == LVAL_BUILTIN && e->cell[0] == items[0]) {
+			// Call builtin with operator, quickening the call
+			r = lquick_call(e, items[0], items + 1, n - 1);
+			if (lval_type(r) == LVAL_ERR) { return r; }
+		} else {
+			r = lval_call(items[0], items + 1, n - 1);
+			if (lval_type(r) == LVAL_ERR) { return r; }
+		}
+		
+	result:
+		if (f->memo) { lmemo_store(lmemo.pending.items[--lmemo.pending.count], r); }
+		
+		// Back to the S-expression this one was an item of, if any
+		s->count = f->top;
+		lvm.frame_count--;
+		if (lvm.frame_count == frames) { return r; }
+		s->items[s->count++] = r;
+	}
+}
+
+lval* lval_eval(lval* v) {
+	// Look up symbols, and return anything else that isn't a S-expression
+	if (lval_type(v) == LVAL_SYM) { return lenv_lookup(v); }
+	if (lval_type(v) != LVAL_SEXPR) { return v; }
+	
+	// Evaluate S-expressions, giving the collector a chance to run first
+	lgc_root(&v);
+	lgc_safepoint();
+	lgc_unroot(1);
+	return lval_eval_sexpr(v);
+}
+
+// Bytecode compiler and VM, see "Bytecode" above
+
+void ljit_release(lchunk* c);
+void ljit_free(lchunk* c);
+
+// Make room for one more level of nested evaluation
+void lchunk_reserve(void) {
+	if (lvm.depth < lvm.cap) { return; }
+	lvm.cap = lvm.cap ? lvm.cap * 2 : 8;
+	lvm.chunks = realloc(lvm.chunks, sizeof(lchunk*) * lvm.cap);
+	lvm.spare = realloc(lvm.spare, sizeof(lchunk*) * lvm.cap);
+	for (int i = lvm.depth; i < lvm.cap; i++) { lvm.spare[i] = calloc(1, sizeof(lchunk)); }
+}
+
+// Empty c, to compile into
+void lchunk_clear(lchunk* c) {
+	c->count = 0;
+	c->last = -1;
+	c->consts.count = 0;
+	c->depth = 0;
+	c->max_depth = 0;
+	c->cache_count = 0;
+	c->site_count = 0;
+	c->input_count = 0;
+	ljit_release(c);
+}
+
+// Empty chunk for the next level of evaluation
+lchunk* lchunk_new(void) {
+	lchunk_reserve();
+	lchunk* c = lvm.spare[lvm.depth];
+	lvm.chunks[lvm.depth++] = c;
+	lchunk_clear(c);
+	return c;
+}
+
+// Run c, which is compiled already, at the next level of evaluation
+void lchunk_enter(lchunk* c) {
+	lchunk_reserve();
+	lvm.chunks[lvm.depth++] = c;
+}
+
+// Give back the chunk from the last lchunk_new or lchunk_enter
+void lchunk_done(void) {
+	lvm.depth--;
+}
+
+// Let the last chunk take the place of the one below it, for a call in
+// tail position
+void lchunk_replace(void) {
+	lchunk* t = lvm.chunks[lvm.depth - 1];
+	lvm.chunks[lvm.depth - 1] = lvm.chunks[lvm.depth - 2];
+	lvm.chunks[lvm.depth - 2] = t;
+	t = lvm.spare[lvm.depth - 1];
+	lvm.spare[lvm.depth - 1] = lvm.spare[lvm.depth - 2];
+	lvm.spare[lvm.depth - 2] = t;
+	lchunk_done();
+}
+
+void lchunk_free(lchunk* c) {
+	ljit_free(c);
+	free(c->code);
+	free(c->consts.items);
+	free(c->caches);
+	free(c->sites);
+	free(c->inputs);
+	free(c);
+}
+
+void lchunk_emit(lchunk* c, int word) {
+	if (c->count == c->cap) {
+		c->cap = c->cap ? c->cap * 2 : 64;
+		c->code = realloc(c->code, sizeof(int) * c->cap);
+	}
+	c->code[c->count++] = word;
+}
+
+void lchunk_op(lchunk* c, int op) {
+	c->last = c->count;
+	lchunk_emit(c, op);
+}
+
+int lchunk_const(lchunk* c, lval* v) {
+	lval_stack_reserve(&c->consts, 1);
+	c->consts.items[c->consts.count] = v;
+	return c->consts.count++;
+}
+
+// A new, empty cache
+int lchunk_cache(lchunk* c) {
+	c->caches = lgrow(c->caches, &c->cache_cap, c->cache_count, sizeof(lcache));
+	c->caches[c->cache_count] = (lcache) { 0, NULL };
+	return c->cache_count++;
+}
+
+// Account for n more values on the stack (or fewer, if negative)
+void lchunk_push(lchunk* c, int n) {
+	c->depth += n;
+	if (c->depth > c->max_depth) { c->max_depth = c->depth; }
+}
+
+// JIT
+//
+// An S-expression built only from + - * / % max min, numbers and
+// variables can be compiled to x86-64 code. The compiler puts an LOP_JIT
+// site before the bytecode for each such S-expression that is not inside
+// another. Once a site has run LJIT_HOT times it is compiled for the
+// types its variables have then: integer arithmetic on fixnums, or double
+// arithmetic wherever larith would have switched to doubles. Native code
+// works on unboxed numbers and boxes only the result.
+//
+// Every variable is guarded to still have the type it was compiled for,
+// and every step that larith would not finish in the same type, such as
+// an overflow, an inexact division or a division by zero, bails out too.
+// When native code gives up the site falls through to its bytecode,
+// which evaluates the S-expression as before and reports any error.
+// After LJIT_MAX_DEOPTS of those the site stops trying.
+//
+// Native code lives in pages of the chunk, writable only while code is
+// being copied in. On Linux each piece is listed in /tmp/perf-<pid>.map,
+// so perf can put samples in JIT'd code down to the site.
+
+#define LJIT_HOT          16
+#define LJIT_MAX_DEOPTS   16
+// How deeply S-expressions compiled as one may nest, which bounds the
+// native stack they use
+#define LJIT_MAX_HEIGHT   32
+#define LJIT_BLOCK_SIZE   (64 * 1024)
+
+// Types of the values native code works on
+enum { LJIT_INT, LJIT_FLOAT };
+
+// An S-expression being walked by ljit_mark
+typedef struct {
+	lval* list;
+	int next;
+	int index;
+	int height;
+	bool fits;
+} ljit_walk;
+
+__thread struct {
+	// Whether each S-expression lvm_compile_sexpr meets, in the order it
+	// meets them, can be compiled as a whole
+	bool* fits;
+	int fits_cap;
+	// Code being generated, and where it jumps to the bail out
+	unsigned char* buf;
+	int count;
+	int cap;
+	int* deopts;
+	int deopt_count;
+	int deopt_cap;
+	// For --alloc-stats: runs native code finished, runs it bailed out
+	// of, and sites given up on
+	long natives;
+	long bail_outs;
+	long given_up;
+} ljit;
+
+// The perf map, which every isolate lists its sites in, and how many sites
+// have been compiled, which names them there
+struct {
+	pthread_mutex_t lock;
+	FILE* file;
+	bool closed;
+	int compiled;
+} ljit_perf = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// The builtins native code can do, in LARITH order
+lbuiltin ljit_ops[] = { builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod,
+                        builtin_max, builtin_min };
+
+// The LARITH operation v calls, or -1 if it is not a call native code can do
+int ljit_op(lval* v) {
+	if (v->count < 2 || lval_type(v->cell[0]) != LVAL_BUILTIN) { return -1; }
+	lbuiltin fn = lquick_generic(v->cell[0])->fn;
+	for (int op = LARITH_ADD; op <= LARITH_MIN; op++) {
+		if (fn == ljit_ops[op]) { return op; }
+	}
+	return -1;
+}
+
+bool ljit_is_leaf(lval* v) {
+	int type = lval_type(v);
+	return type == LVAL_INT || type == LVAL_FLOAT || type == LVAL_SYM || type == LVAL_LOCAL;
+}
+
+// Fill in ljit.fits for v as an S-expression and those inside it, from
+// the bottom up in one walk
+void ljit_mark(lval* v) {
+	static __thread ljit_walk* open;
+	static __thread int cap;
+	int count = 0;
+	int index = 0;
+	open = lgrow(open, &cap, count, sizeof(ljit_walk));
+	open[count++] = (ljit_walk) { v, 0, index++, 1, ljit_op(v) >= 0 };
+	
+	while (true) {
+		ljit_walk* w = &open[count - 1];
+		if (w->next < w->list->count) {
+			lval* x = w->list->cell[w->next++];
+			if (lval_type(x) == LVAL_SEXPR) {
+				open = lgrow(open, &cap, count, sizeof(ljit_walk));
+				open[count++] = (ljit_walk) { x, 0, index++, 1, ljit_op(x) >= 0 };
+			} else if (w->next > 1 && !ljit_is_leaf(x)) {
+				w->fits = false;
+			}
+			continue;
+		}
+		
+		bool fits = w->fits && w->height <= LJIT_MAX_HEIGHT;
+		ljit.fits = lgrow(ljit.fits, &ljit.fits_cap, w->index, sizeof(bool));
+		ljit.fits[w->index] = fits;
+		if (--count == 0) { return; }
+		
+		ljit_walk* up = &open[count - 1];
+		up->fits = up->fits && fits;
+		if (w->height + 1 > up->height) { up->height = w->height + 1; }
+	}
+}
+
+// Add a site for v, returning its number
+int ljit_site_new(lchunk* c, lval* v) {
+	c->sites = lgrow(c->sites, &c->site_cap, c->site_count, sizeof(ljit_site));
+	c->sites[c->site_count] = (ljit_site) { .expr = lchunk_const(c, v) };
+	return c->site_count++;
+}
+
+// The value of input i of site j, or NULL if it is an unbound global
+lval* ljit_input_value(lchunk* c, ljit_site* j, int i, int locals) {
+	ljit_input* in = &c->inputs[j->input_from + i];
+	if (in->sym) { return lenv_cached(&in->cache, in->sym); }
+	return lvm_local(in->slot, locals);
+}
+
+#ifdef LJIT
+
+void ljit_emit(unsigned char* bytes, int n) {
+	while (ljit.count + n > ljit.cap) {
+		ljit.cap = ljit.cap ? ljit.cap * 2 : 4096;
+		ljit.buf = realloc(ljit.buf, ljit.cap);
+	}
+	memcpy(ljit.buf + ljit.count, bytes, n);
+	ljit.count += n;
+}
+
+#define LJIT_EMIT(...) \
+	ljit_emit((unsigned char[]) { __VA_ARGS__ }, sizeof((unsigned char[]) { __VA_ARGS__ }))
+
+void ljit_emit64(uint64_t x) {
+	ljit_emit((unsigned char*) &x, 8);
+}
+
+// x86 condition codes
+enum { LJIT_O = 0x0, LJIT_B = 0x2, LJIT_E = 0x4, LJIT_NE = 0x5, LJIT_BE = 0x6, LJIT_P = 0xA,
+       LJIT_ALWAYS = -1 };
+
+// Jump to the bail out if cc holds
+void ljit_deopt_if(int cc) {
+	LJIT_EMIT(0x0F, 0x80 + cc, 0, 0, 0, 0);
+	ljit.deopts = lgrow(ljit.deopts, &ljit.deopt_cap, ljit.deopt_count, sizeof(int));
+	ljit.deopts[ljit.deopt_count++] = ljit.count - 4;
+}
+
+// A short jump forward if cc holds, to be landed by ljit_land
+int ljit_jump(int cc) {
+	if (cc == LJIT_ALWAYS) {
+		LJIT_EMIT(0xEB, 0);
+	} else {
+		LJIT_EMIT(0x70 + cc, 0);
+	}
+	return ljit.count - 1;
+}
+
+void ljit_land(int jump) {
+	ljit.buf[jump] = (unsigned char) (ljit.count - jump - 1);
+}
+
+// rax = rax op rcx on integers, bailing out wherever larith_int_step
+// would not give an integer
+void ljit_int_step(int op) {
+	int skip;
+	int done;
+	switch (op) {
+		case LARITH_ADD:
+			LJIT_EMIT(0x48, 0x01, 0xC8);                  // add rax, rcx
+			ljit_deopt_if(LJIT_O);
+			break;
+		case LARITH_SUB:
+			LJIT_EMIT(0x48, 0x29, 0xC8);                  // sub rax, rcx
+			ljit_deopt_if(LJIT_O);
+			break;
+		case LARITH_MUL:
+			LJIT_EMIT(0x48, 0x0F, 0xAF, 0xC1);            // imul rax, rcx
+			ljit_deopt_if(LJIT_O);
+			break;
+		case LARITH_DIV:
+		case LARITH_MOD:
+			LJIT_EMIT(0x48, 0x85, 0xC9);                  // test rcx, rcx
+			ljit_deopt_if(LJIT_E);
+			// idiv faults on the lowest long over -1, so that is done apart
+			LJIT_EMIT(0x48, 0x83, 0xF9, 0xFF);            // cmp rcx, -1
+			skip = ljit_jump(LJIT_NE);
+			if (op == LARITH_DIV) {
+				LJIT_EMIT(0x48, 0xF7, 0xD8);              // neg rax
+				ljit_deopt_if(LJIT_O);
+			} else {
+				LJIT_EMIT(0x31, 0xC0);                    // xor eax, eax
+			}
+			done = ljit_jump(LJIT_ALWAYS);
+			ljit_land(skip);
+			LJIT_EMIT(0x48, 0x99);                        // cqo
+			LJIT_EMIT(0x48, 0xF7, 0xF9);                  // idiv rcx
+			if (op == LARITH_DIV) {
+				LJIT_EMIT(0x48, 0x85, 0xD2);              // test rdx, rdx
+				ljit_deopt_if(LJIT_NE);
+			} else {
+				LJIT_EMIT(0x48, 0x89, 0xD0);              // mov rax, rdx
+			}
+			ljit_land(done);
+			break;
+		case LARITH_MAX:
+			LJIT_EMIT(0x48, 0x39, 0xC8);                  // cmp rax, rcx
+			LJIT_EMIT(0x48, 0x0F, 0x4C, 0xC1);            // cmovl rax, rcx
+			break;
+		case LARITH_MIN:
+			LJIT_EMIT(0x48, 0x39, 0xC8);                  // cmp rax, rcx
+			LJIT_EMIT(0x48, 0x0F, 0x4F, 0xC1);            // cmovg rax, rcx
+			break;
+	}
+}
+
+// xmm0 = xmm0 op xmm1 as larith_float_step does, bailing out where it
+// would fail. % needs fmod, so is never compiled for doubles.
+void ljit_float_step(int op) {
+	int skip;
+	switch (op) {
+		case LARITH_ADD: LJIT_EMIT(0xF2, 0x0F, 0x58, 0xC1); break;   // addsd xmm0, xmm1
+		case LARITH_SUB: LJIT_EMIT(0xF2, 0x0F, 0x5C, 0xC1); break;   // subsd xmm0, xmm1
+		case LARITH_MUL: LJIT_EMIT(0xF2, 0x0F, 0x59, 0xC1); break;   // mulsd xmm0, xmm1
+		case LARITH_DIV:
+			LJIT_EMIT(0x66, 0x0F, 0x57, 0xD2);            // xorpd xmm2, xmm2
+			LJIT_EMIT(0x66, 0x0F, 0x2E, 0xCA);            // ucomisd xmm1, xmm2
+			skip = ljit_jump(LJIT_P);
+			ljit_deopt_if(LJIT_E);
+			ljit_land(skip);
+			LJIT_EMIT(0xF2, 0x0F, 0x5E, 0xC1);            // divsd xmm0, xmm1
+			break;
+		case LARITH_MAX:
+			LJIT_EMIT(0x66, 0x0F, 0x2E, 0xC8);            // ucomisd xmm1, xmm0
+			skip = ljit_jump(LJIT_BE);
+			LJIT_EMIT(0x66, 0x0F, 0x28, 0xC1);            // movapd xmm0, xmm1
+			ljit_land(skip);
+			break;
+		case LARITH_MIN:
+			LJIT_EMIT(0x66, 0x0F, 0x2E, 0xC1);            // ucomisd xmm0, xmm1
+			skip = ljit_jump(LJIT_BE);
+			LJIT_EMIT(0x66, 0x0F, 0x28, 0xC1);            // movapd xmm0, xmm1
+			ljit_land(skip);
+			break;
+	}
+}
+
+// Load input i into rax, guarded to be of the type it has now. Returns
+// that type, or -1 if it has none native code can use.
+int ljit_gen_input(lchunk* c, ljit_site* j, lval* v, int locals) {
+	
+	// Each variable is one input, however often it is read
+	int i = 0;
+	for (; i < j->input_count; i++) {
+		ljit_input* in = &c->inputs[j->input_from + i];
+		if (lval_type(v) == LVAL_SYM ? in->sym == v : !in->sym && in->slot == v->slot) { break; }
+	}
+	if (i == j->input_count) {
+		c->inputs = lgrow(c->inputs, &c->input_cap, c->input_count, sizeof(ljit_input));
+		bool global = lval_type(v) == LVAL_SYM;
+		c->inputs[c->input_count++] = (ljit_input) { global ? v : NULL, global ? 0 : v->slot, { 0, NULL } };
+		j->input_count++;
+	}
+	lval* x = ljit_input_value(c, j, i, locals);
+	if (x == NULL || (!lval_is_fixnum(x) && !lval_is_double(x))) { return -1; }
+	
+	LJIT_EMIT(0x48, 0x8B, 0x87);                          // mov rax, [rdi + 8i]
+	int32_t disp = i * 8;
+	ljit_emit((unsigned char*) &disp, 4);
+	LJIT_EMIT(0x48, 0x89, 0xC1);                          // mov rcx, rax
+	LJIT_EMIT(0x48, 0xC1, 0xE9, 49);                      // shr rcx, 49
+	LJIT_EMIT(0x81, 0xF9, 0xFF, 0x7F, 0, 0);              // cmp ecx, 0x7FFF
+	if (lval_is_fixnum(x)) {
+		ljit_deopt_if(LJIT_NE);
+		LJIT_EMIT(0x48, 0xC1, 0xE0, 15);                  // shl rax, 15
+		LJIT_EMIT(0x48, 0xC1, 0xF8, 15);                  // sar rax, 15
+		return LJIT_INT;
+	}
+	ljit_deopt_if(LJIT_E);
+	LJIT_EMIT(0x48, 0xB9);                                // mov rcx, LVAL_DOUBLE_OFFSET
+	ljit_emit64(LVAL_DOUBLE_OFFSET);
+	LJIT_EMIT(0x48, 0x29, 0xC8);                          // sub rax, rcx
+	ljit_deopt_if(LJIT_B);
+	return LJIT_FLOAT;
+}
+
+// Code leaving the value of v in rax, an integer or a double's bits.
+// Returns its type, or -1 if v cannot be compiled after all.
+int ljit_gen(lchunk* c, ljit_site* j, lval* v, int locals) {
+	switch (lval_type(v)) {
+		case LVAL_INT:
+			LJIT_EMIT(0x48, 0xB8);                        // mov rax, imm64
+			ljit_emit64((uint64_t) lval_get_int(v));
+			return LJIT_INT;
+		case LVAL_FLOAT: {
+			double x = lval_get_float(v);
+			LJIT_EMIT(0x48, 0xB8);
+			ljit_emit((unsigned char*) &x, 8);
+			return LJIT_FLOAT;
+		}
+		case LVAL_SYM:
+		case LVAL_LOCAL:
+			return ljit_gen_input(c, j, v, locals);
+	}
+	
+	// A call, which works through its arguments as larith does: on
+	// integers until the first double, then on doubles
+	int op = ljit_op(v);
+	int type = ljit_gen(c, j, v->cell[1], locals);
+	if (type < 0) { return -1; }
+	if (v->count == 2 && op == LARITH_SUB) {
+		if (type == LJIT_INT) {
+			LJIT_EMIT(0x48, 0xF7, 0xD8);                  // neg rax
+			ljit_deopt_if(LJIT_O);
+		} else {
+			LJIT_EMIT(0x48, 0x0F, 0xBA, 0xF8, 63);        // btc rax, 63
+		}
+	}
+	
+	for (int i = 2; i < v->count; i++) {
+		LJIT_EMIT(0x50);                                  // push rax
+		int y = ljit_gen(c, j, v->cell[i], locals);
+		if (y < 0) { return -1; }
+		LJIT_EMIT(0x48, 0x89, 0xC1);                      // mov rcx, rax
+		LJIT_EMIT(0x58);                                  // pop rax
+		if (type == LJIT_INT && y == LJIT_INT) {
+			ljit_int_step(op);
+			continue;
+		}
+		if (op == LARITH_MOD) { return -1; }
+		if (type == LJIT_INT) {
+			LJIT_EMIT(0xF2, 0x48, 0x0F, 0x2A, 0xC0);      // cvtsi2sd xmm0, rax
+		} else {
+			LJIT_EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC0);      // movq xmm0, rax
+		}
+		if (y == LJIT_INT) {
+			LJIT_EMIT(0xF2, 0x48, 0x0F, 0x2A, 0xC9);      // cvtsi2sd xmm1, rcx
+		} else {
+			LJIT_EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC9);      // movq xmm1, rcx
+		}
+		ljit_float_step(op);
+		LJIT_EMIT(0x66, 0x48, 0x0F, 0x7E, 0xC0);          // movq rax, xmm0
+		type = LJIT_FLOAT;
+	}
+	return type;
+}
+
+// Room for n bytes of native code in c's pages
+unsigned char* ljit_alloc(lchunk* c, size_t n) {
+	ljit_block* b = c->blocks;
+	if (b == NULL || b->size - b->used < n) {
+		size_t size = n > LJIT_BLOCK_SIZE ? (n + 4095) & ~(size_t) 4095 : LJIT_BLOCK_SIZE;
+		void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (code == MAP_FAILED) { return NULL; }
+		b = malloc(sizeof(ljit_block));
+		*b = (ljit_block) { c->blocks, code, size, 0 };
+		c->blocks = b;
+	}
+	unsigned char* p = b->code + b->used;
+	b->used = (b->used + n + 15) & ~(size_t) 15;
+	return p;
+}
+
+// Copy the generated code into c's pages
+unsigned char* ljit_install(lchunk* c) {
+	unsigned char* p = ljit_alloc(c, ljit.count);
+	if (p == NULL) { return NULL; }
+	ljit_block* b = c->blocks;
+	if (mprotect(b->code, b->size, PROT_READ | PROT_WRITE) != 0) { return NULL; }
+	memcpy(p, ljit.buf, ljit.count);
+	if (mprotect(b->code, b->size, PROT_READ | PROT_EXEC) != 0) { return NULL; }
+	return p;
+}
+
+void ljit_perf_close(void) {
+	pthread_mutex_lock(&ljit_perf.lock);
+	if (ljit_perf.file) { fclose(ljit_perf.file); }
+	ljit_perf.file = NULL;
+	ljit_perf.closed = true;
+	pthread_mutex_unlock(&ljit_perf.lock);
+}
+
+// List the n bytes of site "id" at "code" in the perf map, opening it the
+// first time. It is appended to, as isolates on other threads share it.
+void ljit_perf_add(unsigned char* code, int n, int id) {
+	pthread_mutex_lock(&ljit_perf.lock);
+	if (ljit_perf.file == NULL && !ljit_perf.closed) {
+		char path[64];
+		snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+		ljit_perf.file = fopen(path, "a");
+		ljit_perf.closed = ljit_perf.file == NULL;
+		if (ljit_perf.file) { atexit(ljit_perf_close); }
+	}
+	if (ljit_perf.file) {
+		fprintf(ljit_perf.file, "%lx %x bilisp_jit_%d\n", (unsigned long) code, (unsigned) n, id);
+		fflush(ljit_perf.file);
+	}
+	pthread_mutex_unlock(&ljit_perf.lock);
+}
+
+// Compile site j, observing the types its inputs have now
+bool ljit_compile(lchunk* c, ljit_site* j, lval* expr, int locals) {
+	ljit.count = 0;
+	ljit.deopt_count = 0;
+	j->input_from = c->input_count;
+	j->input_count = 0;
+	
+	LJIT_EMIT(0x49, 0x89, 0xE0);                          // mov r8, rsp
+	int type = ljit_gen(c, j, expr, locals);
+	if (type < 0) { return false; }
+	LJIT_EMIT(0x48, 0x89, 0x06);                          // mov [rsi], rax
+	LJIT_EMIT(0xB8, 1, 0, 0, 0);                          // mov eax, 1
+	LJIT_EMIT(0xC3);                                      // ret
+	
+	// Bailing out drops whatever is still pushed
+	for (int i = 0; i < ljit.deopt_count; i++) {
+		int32_t rel = ljit.count - (ljit.deopts[i] + 4);
+		memcpy(ljit.buf + ljit.deopts[i], &rel, 4);
+	}
+	LJIT_EMIT(0x4C, 0x89, 0xC4);                          // mov rsp, r8
+	LJIT_EMIT(0x31, 0xC0);                                // xor eax, eax
+	LJIT_EMIT(0xC3);                                      // ret
+	
+	unsigned char* code = ljit_install(c);
+	if (code == NULL) { return false; }
+	j->fn = (ljit_fn) code;
+	j->is_float = type == LJIT_FLOAT;
+	int id = __atomic_add_fetch(&ljit_perf.compiled, 1, __ATOMIC_RELAXED);
+	
+#if defined(__linux__)
+	ljit_perf_add(code, ljit.count, id);
+#endif
+	return true;
+}
+
+// Give back all but the first of c's pages, for it to be used again
+void ljit_release(lchunk* c) {
+	ljit_block* b = c->blocks;
+	if (b == NULL) { return; }
+	while (b->next) {
+		ljit_block* next = b->next->next;
+		munmap(b->next->code, b->next->size);
+		free(b->next);
+		b->next = next;
+	}
+	b->used = 0;
+}
+
+// Give back all of c's pages, as it is being freed
+void ljit_free(lchunk* c) {
+	ljit_release(c);
+	if (c->blocks == NULL) { return; }
+	munmap(c->blocks->code, c->blocks->size);
+	free(c->blocks);
+	c->blocks = NULL;
+}
+
+#else
+
+bool ljit_compile(lchunk* c, ljit_site* j, lval* expr, int locals) { return false; }
+void ljit_release(lchunk* c) {}
+void ljit_free(lchunk* c) {}
+
+#endif
+
+// The result of site j, or NULL to carry on with its bytecode
+lval* ljit_run(lchunk* c, ljit_site* j, lval* expr, int locals) {
+	if (j->failed) { return NULL; }
+	if (j->fn == NULL) {
+		if (++j->runs < LJIT_HOT) { return NULL; }
+		if (!ljit_compile(c, j, expr, locals)) {
+			j->failed = true;
+			return NULL;
+		}
+	}
+	
+	static __thread lval** in;
+	static __thread int cap;
+	in = lgrow(in, &cap, j->input_count, sizeof(lval*));
+	for (int i = 0; i < j->input_count; i++) {
+		in[i] = ljit_input_value(c, j, i, locals);
+		if (in[i] == NULL) { goto deopt; }
+	}
+	
+	union { long i; double f; } out;
+	if (j->fn(in, &out)) {
+		ljit.natives++;
+		return j->is_float ? lval_float(out.f) : lval_int(out.i);
+	}
+	
+deopt:
+	ljit.bail_outs++;
+	if (++j->deopts == LJIT_MAX_DEOPTS) {
+		j->failed = true;
+		ljit.given_up++;
+	}
+	return NULL;
+}
+
+void ljit_print_stats(void) {
+	printf(";; jit: %d sites compiled, %ld native runs, %ld bail-outs, %ld sites given up\n",
+	       __atomic_load_n(&ljit_perf.compiled, __ATOMIC_RELAXED), ljit.natives, ljit.bail_outs, ljit.given_up);
+}
+
+// Calls to a builtin the reader linked, the usual case, leave the builtin
+// off the stack, so their items are compiled from the second on
+bool lvm_is_linked_call(lval* v) {
+	return v->count > 0 && lval_type(v->cell[0]) == LVAL_BUILTIN;
+}
+
+// The call for an S-expression whose items have been compiled
+void lvm_compile_call(lchunk* c, lval* v) {
+	if (!lvm_is_linked_call(v)) {
+		lchunk_op(c, LOP_APPLY);
+		lchunk_emit(c, v->count);
+		lchunk_push(c, 1 - v->count);
+		return;
+	}
+	
+	if (v->count == 2 && v->cell[0]->fn == builtin_eval) {
+		lchunk_op(c, LOP_EVAL);
+		return;
+	}
+	if (v->count == 3 && v->cell[0]->fn == builtin_lambda) {
+		lchunk_op(c, LOP_LAMBDA);
+		lchunk_push(c, -1);
+		return;
+	}
+	lchunk_op(c, LOP_CALL);
+	lchunk_emit(c, lchunk_const(c, v));
+	lchunk_emit(c, v->count - 1);
+	lchunk_push(c, 2 - v->count);
+}
+
+void lvm_compile_value(lchunk* c, lval* v);
+
+// Start an LOP_JIT for v, if it is the index'th S-expression met and the
+// JIT can compile it. Returns where the word to skip by goes, or -1.
+int lvm_compile_jit(lchunk* c, lval* v, int index) {
+	if (!ljit.fits[index]) { return -1; }
+	lchunk_op(c, LOP_JIT);
+	lchunk_emit(c, ljit_site_new(c, v));
+	lchunk_emit(c, 0);
+	return c->count - 1;
+}
+
+// Start an LOP_MEMO for v. Returns where the word to skip by goes.
+int lvm_compile_memo(lchunk* c, lval* v) {
+	lchunk_op(c, LOP_MEMO);
+	lchunk_emit(c, lchunk_const(c, v));
+	lchunk_emit(c, 0);
+	return c->count - 1;
+}
+
+// Start the S-expression v, at the given level of lvm_compile_sexpr's
+// stack, with an LOP_FORK for its items worth forking, noting which they
+// are on "joins" so an LOP_JOIN takes the place of each
+void lvm_compile_fork(lchunk* c, lval* v, int level, lpar_join** joins, int* count, int* cap) {
+	lpar_worker* w = &lpar.workers[0];
+	int picks = lpar_pick(w, v, false);
+	if (picks < 2) { return; }
+	lchunk_op(c, LOP_FORK);
+	lchunk_emit(c, c->consts.count);
+	lchunk_emit(c, picks);
+	for (int p = 0; p < picks; p++) { lchunk_const(c, v->cell[w->picks[p]]); }
+	for (int p = picks - 1; p >= 0; p--) {
+		*joins = lgrow(*joins, cap, *count, sizeof(lpar_join));
+		(*joins)[(*count)++] = (lpar_join) { level, w->picks[p], NULL };
+	}
+}
+
+// Compile the items of v as an S-expression, whatever v's type. The
+// S-expressions still being compiled are kept on a stack rather than
+// recursed into, so nesting is limited only by memory.
+void lvm_compile_sexpr(lchunk* c, lval* v) {
+	static __thread lwalk* open;
+	static __thread int cap;
+	static __thread lpar_join* joins;
+	static __thread int join_cap;
+	int count = 0;
+	int join_count = 0;
+	
+	// Likewise for the S-expressions lval_eval_sexpr would memoize, whose
+	// LOP_STORE follows their call
+	bool memo = lmemo.on && !lmemo.inside;
+	int memo_level = 0;
+	int memo_skip = -1;
+	if (memo && lmemo_is_pure(v)) {
+		memo_skip = lmemo.looked ? -1 : lvm_compile_memo(c, v);
+		memo_level = 1;
+	}
+	lmemo.looked = lmemo.inside = false;
+	
+	// With the JIT on, the outermost S-expressions it can compile get a
+	// site, whose skip is filled in once their bytecode is done
+	int index = 0;
+	int jit_level = 0;
+	int jit_skip = -1;
+	if (lvm.jit) {
+		ljit_mark(v);
+		jit_skip = lvm_compile_jit(c, v, index);
+		if (jit_skip >= 0) { jit_level = 1; }
+	}
+	index++;
+	
+	open = lgrow(open, &cap, count, sizeof(lwalk));
+	open[count++] = (lwalk) { v, lvm_is_linked_call(v) };
+	if (lvm.parallel) { lvm_compile_fork(c, v, count, &joins, &join_count, &join_cap); }
+	
+	while (count > 0) {
+		lwalk* w = &open[count - 1];
+		if (w->next == w->list->count) {
+			lvm_compile_call(c, w->list);
+			if (count == jit_level) {
+				c->code[jit_skip] = c->count - jit_skip - 1;
+				jit_level = 0;
+			}
+			if (count == memo_level) {
+				lchunk_op(c, LOP_STORE);
+				if (memo_skip >= 0) { c->code[memo_skip] = c->count - memo_skip - 1; }
+				memo_level = 0;
+			}
+			count--;
+			continue;
+		}
+		
+		lval* x = w->list->cell[w->next++];
+		if (lval_type(x) == LVAL_SEXPR && join_count > 0 &&
+		    joins[join_count - 1].frame == count && joins[join_count - 1].item == w->next - 1) {
+			// A forked item, so the S-expressions in it are not met here
+			join_count--;
+			lchunk_op(c, LOP_JOIN);
+			lchunk_push(c, 1);
+			index += lpar_sexpr_count(x);
+			continue;
+		}
+		if (lval_type(x) == LVAL_SEXPR) {
+			if (memo && memo_level == 0 && lmemo_wants(x)) {
+				memo_skip = lvm_compile_memo(c, x);
+				memo_level = count + 1;
+			}
+			if (lvm.jit && jit_level == 0) {
+				jit_skip = lvm_compile_jit(c, x, index);
+				if (jit_skip >= 0) { jit_level = count + 1; }
+			}
+			index++;
+			open = lgrow(open, &cap, count, sizeof(lwalk));
+			open[count++] = (lwalk) { x, lvm_is_linked_call(x) };
+			if (lvm.parallel) { lvm_compile_fork(c, x, count, &joins, &join_count, &join_cap); }
+		} else {
+			lvm_compile_value(c, x);
+		}
+	}
+}
+
+void lvm_compile(lchunk* c, lval* v) {
+	if (lval_type(v) == LVAL_SEXPR) {
+		lvm_compile_sexpr(c, v);
+	} else {
+		lvm_compile_value(c, v);
+	}
+}
+
+// Compile anything but an S-expression
+void lvm_compile_value(lchunk* c, lval* v) {
+	lchunk_push(c, 1);
+	if (lval_type(v) == LVAL_ERR) {
+		lchunk_op(c, LOP_ERROR);
+		lchunk_emit(c, lchunk_const(c, v));
+		return;
+	}
+	if (lval_type(v) == LVAL_SYM) {
+		lchunk_op(c, LOP_GLOBAL);
+		lchunk_emit(c, lchunk_const(c, v));
+		lchunk_emit(c, lchunk_cache(c));
+		return;
+	}
+	if (lval_type(v) == LVAL_LOCAL) {
+		lchunk_op(c, LOP_LOCAL);
+		lchunk_emit(c, v->slot);
+		return;
+	}
+	
+	// Constants are numbered in the order they are pushed, so a run of
+	// them is one instruction
+	int k = lchunk_const(c, v);
+	if (c->last >= 0 && c->code[c->last] == LOP_CONST && c->last + 3 == c->count) {
+		c->code[c->last + 2]++;
+		return;
+	}
+	lchunk_op(c, LOP_CONST);
+	lchunk_emit(c, k);
+	lchunk_emit(c, 1);
+}
+
+// Whether lvm_compile_body keeps the chunk for v. Chunks compiled while
+// memoizing or forking depend on more than v, and a task on the pool can
+// not hold on to what it reads. As in lenv_cached, young bodies are left
+// out, as a minor collection would move them.
+bool lvm_keeps(lval* v) {
+	return !lmemo.on && !lvm.parallel && lpar_arena_now == NULL &&
+		!lval_is_immediate(v) && !(v->flags & LGC_YOUNG) && !lpar_in_arena(v);
+}
+
+// The slot of lvm.cached for v, or the empty one where it belongs
+lvm_cached* lvm_cached_slot(lval* v) {
+	int mask = 2 * LVM_CACHED_MAX - 1;
+	if (lvm.cached == NULL) { lvm.cached = calloc(mask + 1, sizeof(lvm_cached)); }
+	int i = lhash_mix(0, (uintptr_t) v) & mask;
+	while (lvm.cached[i].body && lvm.cached[i].body != v) { i = (i + 1) & mask; }
+	return &lvm.cached[i];
+}
+
+// The chunk for the S-expression v, to be run by lvm_exec. The chunk for
+// a lambda body or Q-expression is kept and run again each time v is, so
+// it is not compiled again and, with the JIT on, its sites get hot.
+lchunk* lvm_compile_body(lval* v) {
+	lvm_cached* k = lvm_keeps(v) ? lvm_cached_slot(v) : NULL;
+	if (k && k->body) {
+		lchunk_enter(k->chunk);
+		return k->chunk;
+	}
+	
+	lchunk* c;
+	if (k && lvm.cached_count < LVM_CACHED_MAX) {
+		c = calloc(1, sizeof(lchunk));
+		lchunk_clear(c);
+		*k = (lvm_cached) { v, c };
+		lvm.cached_count++;
+		lval_stack_reserve(&lvm.bodies, 1);
+		lvm.bodies.items[lvm.bodies.count++] = v;
+		lchunk_enter(c);
+	} else {
+		c = lchunk_new();
+	}
+	lvm_compile_sexpr(c, v);
+	lchunk_op(c, LOP_RETURN);
+	return c;
+}
+
+// Run a chunk ending in LOP_RETURN. Builtins can run chunks of their own,
+// which may move the stack, so it is always reached through lvm.stack.
+//
+// Each running chunk has its constants on the stack below its values.
+// The constants are kept in a list rather than on a root stack: once the
+// list is old, minor collections leave it alone however big the line was.
+lval* lvm_exec(lchunk* c) {
+	lval_stack* s = &lvm.stack;
+	int entry = s->count;
+	int frames = lvm.frame_count;
+	lval_stack_reserve(s, c->max_depth + 1);
+	
+	lval* consts = lval_list_of(LVAL_SEXPR, c->consts.items, c->consts.count);
+	lgc_root(&consts);
+	s->items[s->count++] = consts;
+	int base = s->count;
+	
+	int pending = lmemo.pending.count;
+	int joins = lvm.parallel ? lpar.workers[0].join_count : 0;
+	int* code = c->code;
+	lcache* caches = c->caches;
+	int pc = 0;
+	int locals = -1;
+	lchunk* e;
+	lval* r;
+	
+#ifdef LVM_THREADED
+	static void* ops[] = { &&op_CONST, &&op_GLOBAL, &&op_LOCAL, &&op_ERROR, &&op_CALL, &&op_APPLY,
+	                        &&op_EVAL, &&op_LAMBDA, &&op_JIT, &&op_MEMO, &&op_STORE, &&op_FORK,
+	                        &&op_JOIN, &&op_RETURN };
+#define LVM_OP(name) op_##name
+#define LVM_NEXT() goto *ops[code[pc++]]
+	LVM_NEXT();
+#else
+#define LVM_OP(name) case LOP_##name
+#define LVM_NEXT() continue
+	for (;;) switch (code[pc++]) {
+#endif
+	
+	LVM_OP(CONST): {
+		int n = code[pc + 1];
+		memcpy(s->items + s->count, consts->cell + code[pc], sizeof(lval*) * n);
+		s->count += n;
+		pc += 2;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(GLOBAL): {
+		lval* sym = consts->cell[code[pc]];
+		lval* v = lenv_cached(&caches[code[pc + 1]], sym);
+		if (v == NULL) {
+			r = lval_err_unbound(sym);
+			goto done;
+		}
+		s->items[s->count++] = v;
+		pc += 2;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(LOCAL):
+		s->items[s->count++] = lvm_local(code[pc++], locals);
+		LVM_NEXT();
+	
+	LVM_OP(ERROR):
+		r = consts->cell[code[pc]];
+		goto done;
+	
+	// The arguments stay on the stack, and so rooted, during the call
+	LVM_OP(CALL): {
+		int n = code[pc + 1];
+		lgc_safepoint();
+		lval* e = consts->cell[code[pc]];
+		r = lquick_call(e, e->cell[0], s->items + s->count - n, n);
+		s->count -= n;
+		pc += 2;
+		if (lval_type(r) == LVAL_ERR) { goto done; }
+		s->items[s->count++] = r;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(APPLY): {
+		int n = code[pc++];
+		lgc_safepoint();
+		if (n == 0) {
+			s->items[s->count++] = lval_sexpr();
+			LVM_NEXT();
+		}
+		
+		// A single value is its own result, otherwise the first is the
+		// function to call and is replaced by the result
+		lval* first = s->items[s->count - n];
+		if (n == 1 && !lval_is_callable(first)) { LVM_NEXT(); }
+		if (n == 2 && lval_is_eval(first, s->items[s->count - 1])) {
+			s->items[s->count - 2] = s->items[s->count - 1];
+			s->count--;
+			goto eval;
+		}
+		if (n == 3 && lval_is_lambda_builtin(first)) {
+			s->items[s->count - 3] = s->items[s->count - 2];
+			s->items[s->count - 2] = s->items[s->count - 1];
+			s->count--;
+			goto lambda;
+		}
+		
+		// The body of a lambda runs on top of the lambda and its
+		// arguments, which are its first slots. In tail position they
+		// replace this chunk's, as eval's chunk does.
+		if (lval_type(first) == LVAL_LAMBDA) {
+			r = lval_lambda_arity(first, n - 1);
+			if (r) { goto done; }
+			int from = s->count - n;
+			if (code[pc] == LOP_RETURN) {
+				int top = lvm.frame_count > frames ? lvm.frames[lvm.frame_count - 1].top : entry;
+				memmove(&s->items[top], &s->items[from], sizeof(lval*) * n);
+				s->count = top + n;
+				locals = top + 1;
+				e = lvm_compile_body(first->cell[LLAMBDA_CODE]);
+				lchunk_replace();
+				goto enter;
+			}
+			if (!lvm_push_frame((lframe) { base, pc, locals, from, false })) {
+				r = lval_err_depth();
+				goto done;
+			}
+			locals = from + 1;
+			e = lvm_compile_body(first->cell[LLAMBDA_CODE]);
+			goto enter;
+		}
+		
+		r = lval_call(first, s->items + s->count - n + 1, n - 1);
+		s->count -= n;
+		if (lval_type(r) == LVAL_ERR) { goto done; }
+		s->items[s->count++] = r;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(EVAL):
+	eval: {
+		lval** top = &s->items[s->count - 1];
+		if (lval_type(*top) != LVAL_QEXPR) {
+			r = builtin_eval(top, 1);
+			goto done;
+		}
+		lgc_safepoint();
+		lval* q = s->items[--s->count];
+		
+		// A memoized value saves compiling q
+		if (lmemo.on && lmemo.pending.count > pending) {
+			lmemo.inside = true;
+		} else if (lmemo.on && lmemo_is_pure(q)) {
+			lval* x = lmemo_find(q);
+			if (x) {
+				s->items[s->count++] = x;
+				LVM_NEXT();
+			}
+			lmemo_pend(q);
+			lmemo.looked = true;
+		}
+		
+		// In tail position the new chunk replaces this one, otherwise this
+		// one waits on a frame until the new one returns
+		bool tail = code[pc] == LOP_RETURN;
+		if (!tail && !lvm_push_frame((lframe) { base, pc, locals, s->count, false })) {
+			r = lval_err_depth();
+			goto done;
+		}
+		
+		// Compiling never collects, so q needs no rooting
+		e = lvm_compile_body(q);
+		if (tail) {
+			s->count = base - 1;
+			lchunk_replace();
+		}
+		goto enter;
+	}
+	
+	// Start on the chunk e
+	enter: {
+		lval_stack_reserve(s, e->max_depth + 1);
+		consts = lval_list_of(LVAL_SEXPR, e->consts.items, e->consts.count);
+		s->items[s->count++] = consts;
+		base = s->count;
+		code = e->code;
+		caches = e->caches;
+		pc = 0;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(LAMBDA):
+	lambda:
+		lgc_safepoint();
+		r = lval_lambda(s->items[s->count - 2], s->items[s->count - 1], locals);
+		if (lval_type(r) == LVAL_ERR) { goto done; }
+		s->items[--s->count - 1] = r;
+		LVM_NEXT();
+	
+	LVM_OP(JIT): {
+		lchunk* now = lvm.chunks[lvm.depth - 1];
+		ljit_site* j = &now->sites[code[pc]];
+		lval* x = ljit_run(now, j, consts->cell[j->expr], locals);
+		if (x) {
+			s->items[s->count++] = x;
+			pc += code[pc + 1];
+		}
+		pc += 2;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(MEMO): {
+		lval* k = consts->cell[code[pc]];
+		lval* x = lmemo_find(k);
+		if (x) {
+			s->items[s->count++] = x;
+			pc += code[pc + 1];
+		} else {
+			lmemo_pend(k);
+		}
+		pc += 2;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(STORE):
+		lmemo_store(lmemo.pending.items[--lmemo.pending.count], s->items[s->count - 1]);
+		LVM_NEXT();
+	
+	// Forked last first, so the first is the next joined
+	LVM_OP(FORK): {
+		for (int i = code[pc + 1] - 1; i >= 0; i--) {
+			lpar_spawn(&lpar.workers[0], consts->cell[code[pc] + i], NULL, NULL, -1, -1);
+		}
+		pc += 2;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(JOIN): {
+		lval* x = lpar_join_next();
+		if (lval_type(x) == LVAL_ERR) {
+			r = x;
+			goto done;
+		}
+		s->items[s->count++] = x;
+		LVM_NEXT();
+	}
+	
+	LVM_OP(RETURN):
+		r = s->items[s->count - 1];
+		if (lvm.frame_count == frames) { goto done; }
+		
+		// Carry on with the chunk that was waiting on this one
+		lchunk_done();
+		lframe* f = &lvm.frames[--lvm.frame_count];
+		s->count = f->top;
+		base = f->base;
+		pc = f->next;
+		locals = f->locals;
+		code = lvm.chunks[lvm.depth - 1]->code;
+		caches = lvm.chunks[lvm.depth - 1]->caches;
+		consts = s->items[base - 1];
+		s->items[s->count++] = r;
+		LVM_NEXT();
+	
+#ifndef LVM_THREADED
+	}
+#endif
+#undef LVM_OP
+#undef LVM_NEXT
+	
+done:
+	lvm.depth -= lvm.frame_count - frames;
+	lvm.frame_count = frames;
+	lmemo.pending.count = pending;
+	if (lvm.parallel) { lpar_leave(joins); }
+	s->count = entry;
+	lgc_unroot(1);
+	return r;
+}
+
+lval* lvm_run(lchunk* c) {
+	lchunk_op(c, LOP_RETURN);
+	lval* r = lvm_exec(c);
+	lchunk_done();
+	return r;
+}
+
+// The same result as lval_eval_sexpr(v)
+lval* lvm_eval_sexpr(lval* v) {
+	lchunk* c = lchunk_new();
+	lvm_compile_sexpr(c, v);
+	return lvm_run(c);
+}
+
+// Set up the parsers, the VM's stack and the global environment of the
+// isolate this thread runs
+void lsetup_isolate(void) {
+	lgrammar_init();
+	lgc_root_stack(&lvm.stack);
+	lgc_root_stack(&lvm.bodies);
+	lgc_root_stack(&lmemo.values);
+	lgc_root_stack(&lmemo.pending);
+	lenv.values = lval_sexpr();
+	lgc_root(&lenv.values);
+}
+
+// Free what the isolate this thread ran kept, as it has ended. Shared
+// nodes are left, as other isolates can hold them.
+void lsetup_release(void) {
+	lgrammar_free();
+	lmem_release();
+	free(lgc.roots.items);
+	free(lgc.stacks.items);
+	free(lgc.remembered.items);
+	free(lgc.work.items);
+	free(lgc.gray.items);
+	free(lvm.stack.items);
+	free(lvm.frames);
+	for (int i = 0; i < lvm.cap; i++) { lchunk_free(lvm.spare[i]); }
+	free(lvm.chunks);
+	free(lvm.spare);
+	for (int i = 0; lvm.cached && i < 2 * LVM_CACHED_MAX; i++) {
+		if (lvm.cached[i].body) { lchunk_free(lvm.cached[i].chunk); }
+	}
+	free(lvm.cached);
+	free(lvm.bodies.items);
+	free(ljit.fits);
+	free(ljit.buf);
+	free(ljit.deopts);
+	free(lenv.slots);
+	free(lhcons.slots);
+	free(lmemo.entries);
+	free(lmemo.buckets);
+	free(lmemo.values.items);
+	free(lmemo.pending.items);
+}
+
+// Set up the builtins, and the main isolate
+void lsetup(void) {
+	lbuiltin_init();
+	lquick_init();
+	lsetup_isolate();
+}
+
+// Isolates
+//
+// isolate starts an interpreter of its own on a new thread, to evaluate a
+// Q-expression. Its heap and collector, environment, evaluators and the
+// scratch they keep are all its own, as the globals that hold them are
+// thread local. The symbol table is the only state isolates share, and
+// it only takes its lock to add a symbol, so they run without locks.
+//
+// Isolates talk by posting values to each other's mailboxes. Symbols,
+// builtins and shared nodes live for the whole session, so they are
+// posted by reference; freeze makes any value that can be shared into
+// shared nodes. Anything else is copied as it is posted, into objects
+// that belong to the message and are made as the receiver's nursery
+// would make big objects. The message belongs to the mailbox until it is
+// taken. The receiver then adopts the objects into its nursery, without
+// copying them again, and the collector frees them once they are
+// garbage. The Q-expression an isolate evaluates reaches it in the same
+// way. A mailbox is a queue that any isolate posts to without a lock and
+// only its owner takes from. The owner sleeps on it while it is empty.
+// The main thread is isolate 0 and has the pool, so in other isolates
+// async evaluates eagerly and pmap and the rest fail.
+//
+// Up to LISO_MAX isolates run at once. The record of one that has ended
+// is reused, with an id LISO_MAX greater than before, so that a value
+// posted to the old id fails rather than reaching the new isolate.
+
+#define LISO_MAX 1024
+
+typedef struct liso_message {
+	struct liso_message* next;
+	lval* value;
+	lpar_arena arena;
+} liso_message;
+
+// An isolate. Its mailbox is a list from "head", the oldest message or a
+// stub, to "tail", which posters swap in their message for and then link
+// it after the one they swapped out.
+typedef struct {
+	// Its slot in liso.all, plus LISO_MAX for each isolate before it there
+	int id;
+	// Set once it has ended. Posters count themselves in "posting" before
+	// they look at it, so that it can wait for them before it empties the
+	// mailbox.
+	int done;
+	int posting;
+	liso_message* head;
+	liso_message* tail;
+	liso_message stub;
+	// Whether the owner is asleep on "wake", or about to be
+	int sleeping;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	// What it evaluates, and the settings of the isolate that started it
+	liso_message* code;
+	int max_depth;
+	bool reference;
+	bool jit;
+	bool hcons;
+	bool memo;
+	size_t memo_budget;
+	int slice;
+	bool gc_stress;
+} liso_instance;
+
+struct {
+	liso_instance* all[LISO_MAX];
+	int count;
+	// Slots of ended isolates, to reuse
+	int free[LISO_MAX];
+	int free_count;
+	// Isolates other than the main one that have not finished
+	int running;
+	pthread_mutex_t lock;
+} liso = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+__thread int liso_id;
+
+bool liso_is_main(void) {
+	return liso_id == 0;
+}
+
+bool liso_started(void) {
+	return __atomic_load_n(&liso.count, __ATOMIC_ACQUIRE) > 1;
+}
+
+liso_instance* liso_add(void) {
+	liso_instance* m = calloc(1, sizeof(liso_instance));
+	m->id = liso.count;
+	m->head = m->tail = &m->stub;
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->wake, NULL);
+	liso.all[m->id] = m;
+	__atomic_store_n(&liso.count, m->id + 1, __ATOMIC_RELEASE);
+	return m;
+}
+
+// A new isolate, making the main one's record first if need be, or NULL
+// if too many are running. Slots of ended isolates are only reused once
+// every slot has been taken, which keeps ids small until then and makes
+// a stale id less likely to come back.
+liso_instance* liso_new(void) {
+	pthread_mutex_lock(&liso.lock);
+	if (liso.count == 0) { liso_add(); }
+	liso_instance* m = NULL;
+	if (liso.count < LISO_MAX) {
+		m = liso_add();
+	} else if (liso.free_count > 0) {
+		m = liso.all[liso.free[--liso.free_count]];
+		m->head = m->tail = &m->stub;
+		m->stub.next = NULL;
+		m->sleeping = 0;
+		// Posters look at "done" before "id", so one that sees it clear
+		// sees the new id
+		int id = m->id <= INT_MAX - LISO_MAX ? m->id + LISO_MAX : m->id % LISO_MAX;
+		__atomic_store_n(&m->id, id, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&m->done, 0, __ATOMIC_SEQ_CST);
+	}
+	pthread_mutex_unlock(&liso.lock);
+	return m;
+}
+
+liso_instance* liso_self(void) {
+	if (__atomic_load_n(&liso.count, __ATOMIC_ACQUIRE) == 0) {
+		pthread_mutex_lock(&liso.lock);
+		if (liso.count == 0) { liso_add(); }
+		pthread_mutex_unlock(&liso.lock);
+	}
+	return liso.all[liso_id % LISO_MAX];
+}
+
+void liso_push(liso_instance* m, liso_message* x) {
+	__atomic_store_n(&x->next, NULL, __ATOMIC_RELAXED);
+	liso_message* prev = __atomic_exchange_n(&m->tail, x, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->next, x, __ATOMIC_RELEASE);
+}
+
+// The oldest message in m, or NULL if there is none, or none that a
+// poster has finished linking in yet. Only m's owner calls this.
+liso_message* liso_pop(liso_instance* m) {
+	liso_message* head = m->head;
+	liso_message* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (head == &m->stub) {
+		if (next == NULL) { return NULL; }
+		m->head = head = next;
+		next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		m->head = next;
+		return head;
+	}
+	// head is the last message, so the stub goes in after it
+	if (__atomic_load_n(&m->tail, __ATOMIC_SEQ_CST) != head) { return NULL; }
+	liso_push(m, &m->stub);
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (next == NULL) { return NULL; }
+	m->head = next;
+	return head;
+}
+
+bool liso_is_empty(liso_instance* m) {
+	return m->head == &m->stub && __atomic_load_n(&m->tail, __ATOMIC_SEQ_CST) == &m->stub;
 }
 
-lval* lval_qexpr(void) {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_QEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
+void liso_message_free(liso_message* x) {
+	lpar_arena_free(&x->arena);
+	free(x);
 }
 
-lval* lval_err(char* m) {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_ERR;
-	v->err = malloc(strlen(m) + 1);
-	strcpy(v->err, m);
-  return v;
+// Whether v is kept as it is in a message: it is never collected or
+// changed
+bool liso_is_kept(lval* v) {
+	return lval_is_immediate(v) || v->type == LVAL_SYM || v->type == LVAL_BUILTIN ||
+		(v->flags & LVAL_HASHED);
+}
+
+// Whether v is copied into a message, rather than stopping the post
+bool liso_is_atom(lval* v) {
+	return v->type == LVAL_INT || v->type == LVAL_ERR || lval_is_vec(v);
 }
 
-void lval_del(lval* v) {
+// A message holding a copy of v in its own arena, or NULL if something in
+// v, such as a lambda, cannot be sent
+liso_message* liso_message_new(lval* v) {
+	static __thread lval** open;
+	static __thread int cap;
+	int count = 0;
+	liso_message* x = calloc(1, sizeof(liso_message));
+	x->arena.loose = true;
+	if (liso_is_kept(v)) {
+		x->value = v;
+		return x;
+	}
+	if (!lval_is_list_value(v) && !liso_is_atom(v)) {
+		free(x);
+		return NULL;
+	}
 	
-	switch (v->type) {
-		case LVAL_ERR: free(v->err); break;
-		case LVAL_SYM: free(v->sym); break;
-		
-		// Q-expressions and S-expressions are deallocated in the same way
-		case LVAL_QEXPR:
-		case LVAL_SEXPR:
-			for (int i = 0; i < v-> count; i++) {
-				lval_del(v->cell[i]);
+	lpar_arena* saved = lpar_arena_now;
+	lpar_arena_now = &x->arena;
+	if (!lval_is_list_value(v)) {
+		x->value = lpar_copy_atom(v);
+		lpar_arena_now = saved;
+		return x;
+	}
+	// As in lpar_copy, each list is copied with its cells as they are,
+	// then the cells that need it are replaced by copies
+	x->value = lval_list_of(v->type, v->cell, v->count);
+	open = lgrow(open, &cap, count, sizeof(lval*));
+	open[count++] = x->value;
+	while (count > 0) {
+		lval* l = open[--count];
+		for (int i = 0; i < l->count; i++) {
+			lval* y = l->cell[i];
+			if (liso_is_kept(y)) { continue; }
+			if (lval_is_list_value(y)) {
+				y = lval_list_of(y->type, y->cell, y->count);
+				open = lgrow(open, &cap, count, sizeof(lval*));
+				open[count++] = y;
+			} else if (liso_is_atom(y)) {
+				y = lpar_copy_atom(y);
+			} else {
+				lpar_arena_now = saved;
+				liso_message_free(x);
+				return NULL;
 			}
-			free(v->cell);
-		break;
+			l->cell[i] = y;
 		}
-		
-		free(v);
+	}
+	lpar_arena_now = saved;
+	return x;
 }
 
-lval* lval_read_int(mpc_ast_t* ast) {
-	errno = 0;
-	long x = strtol(ast->contents, NULL, 10);
-	return errno != ERANGE ?
-		lval_int(x) : lval_err("Invalid integer");
+// The value of x, whose objects join this isolate's nursery as they are,
+// freeing x
+lval* liso_message_take(liso_message* x) {
+	lval* v = x->value;
+	lmem_large_adopt(x->arena.large);
+	x->arena.large = NULL;
+	liso_message_free(x);
+	return v;
 }
 
-lval* lval_read_float(mpc_ast_t* ast) {
-	errno = 0;
-	char* float_string;
-	float_string = (char *) malloc(sizeof(char));
-  *float_string = '\0';
-	for (int i = 0; i < ast->children_num; i++) {
-		char* child = ast->children[i]->contents;
-		float_string = realloc(float_string, strlen(float_string) + strlen(child));
-		strcat(float_string, child);
+// Post x to the isolate with the given id, returning false, with x left
+// to the caller, if it has ended
+bool liso_post(long id, liso_message* x) {
+	liso_instance* m = liso.all[id % LISO_MAX];
+	__atomic_add_fetch(&m->posting, 1, __ATOMIC_SEQ_CST);
+	bool live = !__atomic_load_n(&m->done, __ATOMIC_SEQ_CST) &&
+		__atomic_load_n(&m->id, __ATOMIC_SEQ_CST) == id;
+	if (live) {
+		liso_push(m, x);
+		if (__atomic_load_n(&m->sleeping, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&m->lock);
+			pthread_cond_signal(&m->wake);
+			pthread_mutex_unlock(&m->lock);
+		}
 	}
-	float x = strtod(float_string, NULL);
-	free(float_string);
-	return errno != ERANGE ? lval_float(x) : lval_err("Invalid float");
+	__atomic_sub_fetch(&m->posting, 1, __ATOMIC_SEQ_CST);
+	return live;
 }
 
-lval* lval_add(lval* list, lval* element) {
-	list->count++;
-	list->cell = realloc(list->cell, sizeof(lval*) * list->count);
-	list->cell[list->count-1] = element;
-	return list;
+// Mark m as ended, empty its mailbox once no one is posting to it, and
+// give its slot back
+void liso_end(liso_instance* m) {
+	__atomic_store_n(&m->done, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&m->posting, __ATOMIC_SEQ_CST) > 0) { sched_yield(); }
+	liso_message* x;
+	while ((x = liso_pop(m)) != NULL) { liso_message_free(x); }
+	pthread_mutex_lock(&liso.lock);
+	liso.free[liso.free_count++] = m->id % LISO_MAX;
+	pthread_mutex_unlock(&liso.lock);
 }
 
-lval* lval_append(lval* element, lval* list) {
-	list->count++;
-	list->cell = realloc(list->cell, sizeof(lval*) * list->count);
-	memmove(&list->cell[1], &list->cell[0], sizeof(lval*) * (list->count - 1));
-	list->cell[0] = element;
-	return list;
+// The next message for this isolate, sleeping until there is one. The
+// main isolate gets NULL if no other is left to post it one.
+lval* liso_take(void) {
+	liso_instance* m = liso_self();
+	while (true) {
+		liso_message* x = liso_pop(m);
+		if (x) { return liso_message_take(x); }
+		if (m->id == 0 && __atomic_load_n(&liso.running, __ATOMIC_SEQ_CST) == 0 && liso_is_empty(m)) {
+			return NULL;
+		}
+		pthread_mutex_lock(&m->lock);
+		__atomic_store_n(&m->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (liso_is_empty(m) && (m->id != 0 || __atomic_load_n(&liso.running, __ATOMIC_SEQ_CST) > 0)) {
+			pthread_cond_wait(&m->wake, &m->lock);
+		}
+		__atomic_store_n(&m->sleeping, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&m->lock);
+	}
 }
 
-lval* lval_read(mpc_ast_t* ast) {
-	
-	if (strstr(ast->tag, "int")) { return lval_read_int(ast); }
-	if (strstr(ast->tag, "float")) { return lval_read_float(ast); }
-	if (strstr(ast->tag, "symbol")) { return lval_sym(ast->contents); }
+void* liso_run(void* arg) {
+	liso_instance* m = arg;
+	liso_id = m->id;
+	lvm.max_depth = m->max_depth;
+	lvm.reference = m->reference;
+	lvm.jit = m->jit;
+	lhcons.on = m->hcons;
+	lmemo.on = m->memo;
+	lmemo.budget = m->memo_budget;
+	lgreen.slice = m->slice;
+	lgc.stress = m->gc_stress;
+	lsetup_isolate();
 	
-	// If root ">", sexpr, or qexpr then create empty list
-	lval* x = NULL;
-	if (strcmp(ast->tag, ">") == 0) { x = lval_sexpr(); }
-	if (strcmp(ast->tag, "sexpr")) { x = lval_sexpr(); }
-	if (strstr(ast->tag, "qexpr")) { x = lval_qexpr(); }
+	lval* code = liso_message_take(m->code);
+	m->code = NULL;
+	lgc_root(&code);
+	lval* r = builtin_eval(&code, 1);
+	lgc_unroot(1);
+	if (lval_type(r) == LVAL_ERR) { printf(";; isolate %d: %s\n", m->id, r->err); }
+	lsetup_release();
+	liso_end(m);
 	
-	for (int i = 0; i < ast->children_num; i++) {
-		if (strcmp(ast->children[i]->contents, "(") == 0) { continue; }
-		if (strcmp(ast->children[i]->contents, ")") == 0) { continue; }
-		if (strcmp(ast->children[i]->contents, "{") == 0) { continue; }
-		if (strcmp(ast->children[i]->contents, "}") == 0) { continue; }
-		if (strcmp(ast->children[i]->tag, "regex") == 0) { continue; }
-		x = lval_add(x, lval_read(ast->children[i]));
+	// The main isolate may be waiting to find out there is no one left
+	__atomic_sub_fetch(&liso.running, 1, __ATOMIC_SEQ_CST);
+	liso_instance* first = liso.all[0];
+	pthread_mutex_lock(&first->lock);
+	pthread_cond_signal(&first->wake);
+	pthread_mutex_unlock(&first->lock);
+	return NULL;
+}
+
+lval* builtin_isolate(lval** args, int n) {
+	LASSERTARGS(n, 1, "isolate");
+	LASSERT(args, lval_type(args[0]) == LVAL_QEXPR,
+		"Function 'isolate' passed incorrect type.");
+	liso_instance* m = liso_new();
+	LASSERT(args, m != NULL, "Too many isolates running");
+	liso_message* code = liso_message_new(args[0]);
+	if (code == NULL) {
+		liso_end(m);
+		return lval_err("Function 'isolate' passed a Q-expression that cannot be sent");
 	}
 	
-	return x;
+	m->code = code;
+	m->max_depth = lvm.max_depth;
+	m->reference = lvm.reference;
+	m->jit = lvm.jit;
+	m->hcons = lhcons.on;
+	m->memo = lmemo.on;
+	m->memo_budget = lmemo.budget;
+	m->slice = lgreen.slice;
+	m->gc_stress = lgc.stress;
+	__atomic_add_fetch(&liso.running, 1, __ATOMIC_SEQ_CST);
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, liso_run, m) != 0) {
+		__atomic_sub_fetch(&liso.running, 1, __ATOMIC_SEQ_CST);
+		liso_message_free(code);
+		liso_end(m);
+		return lval_err("Function 'isolate' could not start a thread");
+	}
+	pthread_detach(thread);
+	return lval_int(m->id);
 }
 
-void lval_print(lval* v);
-
-void lval_expr_print(lval* list, char open, char close) {
-	putchar(open);
-	for (int i = 0; i < list->count; i++) {
-		lval_print(list->cell[i]);
-		
-		if (i != (list->count-1)) {
-			putchar(' ');
-		}
+lval* builtin_post(lval** args, int n) {
+	LASSERTARGS(n, 2, "post");
+	LASSERT(args, lval_type(args[0]) == LVAL_INT,
+		"Function 'post' passed incorrect type.");
+	liso_self();
+	long id = lval_get_int(args[0]);
+	LASSERT(args, id >= 0 && id % LISO_MAX < __atomic_load_n(&liso.count, __ATOMIC_ACQUIRE),
+		"Function 'post' passed an isolate that does not exist");
+	liso_message* x = liso_message_new(args[1]);
+	LASSERT(args, x != NULL,
+		"Function 'post' passed a value that cannot be sent");
+	if (!liso_post(id, x)) {
+		liso_message_free(x);
+		return lval_err("Function 'post' passed an isolate that has ended");
 	}
-	putchar(close);
+	return lval_sexpr();
 }
 
-// Print an lval
-void lval_print(lval* v) {
-	switch (v->type) {
-		case LVAL_INT: printf("%li", v->i); break;
-		case LVAL_FLOAT: printf("%f", v->f); break;
-		case LVAL_ERR: printf("%s", v->err); break;
-		case LVAL_SYM: printf("%s", v->sym); break;
-		case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-		case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
-	}
+lval* builtin_take(lval** args, int n) {
+	LASSERTARGS(n, 0, "take");
+	lval* v = liso_take();
+	LASSERT(args, v != NULL, "Function 'take' would wait forever");
+	return v;
 }
 
-void lval_println(lval* v) {lval_print(v); putchar('\n'); }
+lval* builtin_self(lval** args, int n) {
+	LASSERTARGS(n, 0, "self");
+	return lval_int(liso_id);
+}
 
-void print_children_details(mpc_ast_t* ast) {
-	mpc_ast_t* child;
-	for (int i = 0; i < ast->children_num; i++) {
-		child = ast->children[i];
-		printf("\n------ Child Number %i ------\n", i);
-		printf("Child %i tag: %s\n", i, child->tag);
-		printf("Child %i contents: %s\n", i, child->contents);
-		printf("Child %i number of children: %i\n", i, child->children_num);
-		printf("\n");
-	}
+// The value as shared nodes, which are posted by reference
+lval* builtin_freeze(lval** args, int n) {
+	LASSERTARGS(n, 1, "freeze");
+	lval* x = lhcons_freeze(args[0]);
+	LASSERT(args, x != NULL, "Function 'freeze' passed a value that cannot be shared");
+	return x;
 }
 
-lval* lval_pop(lval* v, int i) {
-	// Get the item at "i"
-	lval* item = v->cell[i];
-	
-	// Shift memory after the item at "i" over the top
-	memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
-	
-	// Decrease the count
-	v->count--;
+// Ahead-of-time compilation
+//
+// prompt --aot file.bl translates a program to C, one function per line,
+// each doing what the line's bytecode would: the same values go on the
+// same stack in the same order, but the dispatch is done once, by the C
+// compiler. Numbers in the source are written into the code as their
+// unboxed words and calls to the builtins the reader linked are direct
+// calls to their C functions. Everything else, Q-expressions and symbols
+// and so on, is built once when the program starts. What needs a value
+// to decide, such as calling a lambda or evaluating a Q-expression, goes
+// to the VM as it would from bytecode.
+//
+// The generated C includes this file with LAOT defined, which leaves out
+// the interpreter's main, so it runs on the same builtins and collector.
+
+// The generated code is written with these
+#define LAOT_IMM(bits) ((lval*)(uintptr_t) (bits##ULL))
+#define LAOT_K(i) laot.consts.items[i]
+#define LAOT_TOP(i) lvm.stack.items[lvm.stack.count - (i)]
+#define LAOT_PUSH(v) (lvm.stack.items[lvm.stack.count++] = (v))
+#define LAOT_CALL(call, n) \
+	lgc_safepoint(); \
+	r = (call); \
+	lvm.stack.count -= (n); \
+	if (lval_type(r) == LVAL_ERR) { goto done; } \
+	LAOT_PUSH(r)
+
+// A line of a program compiled ahead of time: the functions that build
+// its constants and run it, or if it did not parse, the parser's error
+typedef struct {
+	void (*consts)(void);
+	lval* (*run)(void);
+	char* error;
+} laot_line;
+
+typedef struct {
+	int const_count;
+	laot_line* lines;
+	int count;
+} laot_program;
+
+struct {
+	// The constants of the program, as a root stack
+	lval_stack consts;
 	
-	// Reallocate the memory used
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-	return item;
+	// While compiling the line: the code for its constants and for the
+	// line itself, the numbers of constants so far and of the line's
+	// caches, and its stack depth so far and whether it can stop early
+	// with an error
+	FILE* consts_out;
+	FILE* code_out;
+	int const_count;
+	int cache_count;
+	int depth;
+	int max_depth;
+	bool jumps;
+} laot;
+
+// The result of applying the first of the top n values of the stack to
+// the rest, as LOP_APPLY does. The values are run as an S-expression:
+// evaluating any value again gives the same value.
+lval* lvm_apply(int n) {
+	lval_stack* s = &lvm.stack;
+	if (n == 0) { return lval_sexpr(); }
+	if (n == 1 && !lval_is_callable(s->items[s->count - 1])) { return s->items[s->count - 1]; }
+	return lvm_eval_sexpr(lval_list_of(LVAL_SEXPR, s->items + s->count - n, n));
 }
 
-lval* lval_take(lval* v, int i) {
-	lval* item = lval_pop(v, i);
-	lval_del(v);
-	return item;
+// Write s as a C string literal
+void laot_string(FILE* out, char* s) {
+	putc('"', out);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '\n') {
+			fputs("\\n", out);
+		} else if (c == '\\' || c == '"' || c == '?') {
+			// '?' too, so no trigraph is ever formed
+			fprintf(out, "\\%c", c);
+		} else if (c < ' ' || c > '~') {
+			fprintf(out, "\\%03o", c);
+		} else {
+			putc(c, out);
+		}
+	}
+	putc('"', out);
 }
 
-lval* builtin_head(lval* a) {
-	LASSERTARGS(a, 1, "head");
-	
-	LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-	  "Function 'head' requires a Q-expression");
-	
-	LASSERT(a, a->cell[0]->count != 0, 
-		"Function 'head' passed an empty Q-expression");
-	
-	// Take the first element and delete the remaining
-	lval* v = lval_take(a, 0);
-	while (v->count > 1) { lval_del(lval_pop(v,1)); }
-	return v;
+// Write v as an expression, if it is an immediate or has been given the
+// constant k
+void laot_ref(FILE* out, lval* v, int k) {
+	if (lval_is_immediate(v)) {
+		fprintf(out, "LAOT_IMM(0x%016llx)", (unsigned long long)(uintptr_t) v);
+	} else {
+		fprintf(out, "LAOT_K(%d)", k);
+	}
 }
 
-lval* builtin_tail(lval* a) {
-	LASSERTARGS(a, 1, "tail");
-	
-	LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-	  "Function 'tail' requires a Q-expression");
+// A new constant for v, which is not a list, or -1 if it cannot be built
+int laot_atom(lval* v) {
+	FILE* out = laot.consts_out;
+	int k = laot.const_count++;
+	fprintf(out, "\tLAOT_K(%d) = ", k);
+	switch (lval_type(v)) {
+	case LVAL_INT:
+		fprintf(out, "lval_int((long) 0x%llxULL);\n", (unsigned long long) v->i);
+		return k;
+	case LVAL_SYM:
+		fputs("lval_sym(", out);
+		laot_string(out, v->sym);
+		fputs(");\n", out);
+		return k;
+	case LVAL_ERR:
+		fputs("lval_err(", out);
+		laot_string(out, v->err);
+		fputs(");\n", out);
+		return k;
+	case LVAL_BUILTIN:
+		fputs("lbuiltin_find(", out);
+		laot_string(out, lquick_generic(v)->name);
+		fputs(");\n", out);
+		return k;
+	case LVAL_I64VEC:
+	case LVAL_F64VEC:
+		// The elements are copied in as their bits, which is exact for both
+		fprintf(out, "lvec_new(%s, %d);\n", v->type == LVAL_I64VEC ? "LVAL_I64VEC" : "LVAL_F64VEC", v->count);
+		if (v->count == 0) { return k; }
+		fprintf(out, "\tmemcpy(LAOT_K(%d)->f64, (uint64_t[]) {", k);
+		for (int i = 0; i < v->count; i++) {
+			uint64_t bits;
+			memcpy(&bits, &v->f64[i], sizeof(bits));
+			fprintf(out, "%s0x%llxULL", i ? ", " : " ", (unsigned long long) bits);
+		}
+		fprintf(out, " }, sizeof(double) * %d);\n", v->count);
+		return k;
+	}
+	fputs("NULL;\n", out);
+	return -1;
+}
+
+// A new constant for v, which is not an immediate. Lists are built from
+// their innermost out, each once its items have been.
+int laot_const(lval* v) {
+	static __thread lwalk* open;
+	static __thread int cap;
+	static __thread int* built;
+	static __thread int built_cap;
+	int count = 0;
+	int built_count = 0;
 	
-	LASSERT(a, a->cell[0]->count != 0, 
-	  "Function 'tail' passed empty Q-expression {}");
+	int type = lval_type(v);
+	if (type != LVAL_SEXPR && type != LVAL_QEXPR) { return laot_atom(v); }
 	
-	// Take the first argument, delete the first element, and return
-	lval* v = lval_take(a,0);
-	lval_del(lval_pop(v,0));
-	return v;
+	open = lgrow(open, &cap, count, sizeof(lwalk));
+	open[count++] = (lwalk) { v, 0 };
+	while (count > 0) {
+		lwalk* w = &open[count - 1];
+		lval* l = w->list;
+		if (w->next < l->count) {
+			lval* x = l->cell[w->next++];
+			int t = lval_type(x);
+			if (t == LVAL_SEXPR || t == LVAL_QEXPR) {
+				open = lgrow(open, &cap, count, sizeof(lwalk));
+				open[count++] = (lwalk) { x, 0 };
+				continue;
+			}
+			int k = lval_is_immediate(x) ? 0 : laot_atom(x);
+			if (k < 0) { return -1; }
+			built = lgrow(built, &built_cap, built_count, sizeof(int));
+			built[built_count++] = k;
+			continue;
+		}
+		
+		FILE* out = laot.consts_out;
+		int k = laot.const_count++;
+		built_count -= l->count;
+		fprintf(out, "\tLAOT_K(%d) = lval_list_of(%s, ", k, l->type == LVAL_SEXPR ? "LVAL_SEXPR" : "LVAL_QEXPR");
+		if (l->count == 0) {
+			fputs("NULL, 0);\n", out);
+		} else {
+			fputs("(lval*[]) {", out);
+			for (int i = 0; i < l->count; i++) {
+				fputs(i ? ", " : " ", out);
+				laot_ref(out, l->cell[i], built[built_count + i]);
+			}
+			fprintf(out, " }, %d);\n", l->count);
+		}
+		built = lgrow(built, &built_cap, built_count, sizeof(int));
+		built[built_count++] = k;
+		count--;
+	}
+	return built[0];
 }
 
-lval* builtin_len(lval* a) {
-	LASSERTARGS(a, 1, "len");
-		
-	LASSERT(a, a->cell[1]->type == LVAL_QEXPR,
-		"Function 'len' requires a Q-expression");
-		
-	return lval_int(a->cell[1]->count);
+// Account for n more values on the stack (or fewer, if negative)
+void laot_push(int n) {
+	laot.depth += n;
+	if (laot.depth > laot.max_depth) { laot.max_depth = laot.depth; }
 }
 
-lval* builtin_cons(lval* a) {
-	LASSERTARGS(a, 2, "cons");
-	
-	LASSERT(a, a->cell[2]->type == LVAL_QEXPR,
-		"Second value to 'cons' is not a Q-Expression");
-		
-	lval* first = lval_pop(a,0);
-	lval* rest = lval_pop(a,0);
-	lval_del(a);
+// Compile anything but an S-expression, as lvm_compile_value does
+bool laot_value(lval* v) {
+	FILE* out = laot.code_out;
+	laot_push(1);
+	if (lval_is_immediate(v)) {
+		fputs("\tLAOT_PUSH(", out);
+		laot_ref(out, v, 0);
+		fputs(");\n", out);
+		return true;
+	}
 	
-	return lval_append(first, rest);
+	int k = laot_const(v);
+	if (k < 0) { return false; }
+	if (lval_type(v) == LVAL_ERR) {
+		laot.jumps = true;
+		fprintf(out, "\tr = LAOT_K(%d);\n\tgoto done;\n", k);
+	} else if (lval_type(v) == LVAL_SYM) {
+		int cache = laot.cache_count++;
+		laot.jumps = true;
+		fprintf(out, "\tif (!(r = lenv_cached(&caches[%d], LAOT_K(%d)))) { r = lval_err_unbound(LAOT_K(%d)); goto done; }\n",
+		        cache, k, k);
+		fputs("\tLAOT_PUSH(r);\n", out);
+	} else {
+		fprintf(out, "\tLAOT_PUSH(LAOT_K(%d));\n", k);
+	}
+	return true;
 }
 
-lval* builtin_list(lval* a) {
-	a->type = LVAL_QEXPR;
-	return a;
+// The call for an S-expression whose items have been compiled, as
+// lvm_compile_call would make it
+void laot_call(lval* v) {
+	FILE* out = laot.code_out;
+	laot.jumps = true;
+	if (!lvm_is_linked_call(v)) {
+		fprintf(out, "\tLAOT_CALL(lvm_apply(%d), %d);\n", v->count, v->count);
+		laot_push(1 - v->count);
+		return;
+	}
+	int n = v->count - 1;
+	lbuiltin_entry* b = &lbuiltin_table[lquick_generic(v->cell[0]) - lbuiltins];
+	fprintf(out, "\tLAOT_CALL(%s(&LAOT_TOP(%d), %d), %d);\n", b->func, n, n, n);
+	laot_push(1 - n);
 }
 
-lval* lval_eval(lval* a);
-lval* builtin_eval(lval* a) {
-	LASSERTARGS(a, 1, "eval");
+// Compile the items of v as an S-expression, in the order
+// lvm_compile_sexpr does
+bool laot_sexpr(lval* v) {
+	static __thread lwalk* open;
+	static __thread int cap;
+	int count = 0;
+	
+	open = lgrow(open, &cap, count, sizeof(lwalk));
+	open[count++] = (lwalk) { v, lvm_is_linked_call(v) };
+	while (count > 0) {
+		lwalk* w = &open[count - 1];
+		if (w->next == w->list->count) {
+			laot_call(w->list);
+			count--;
+			continue;
+		}
+		
+		lval* x = w->list->cell[w->next++];
+		if (lval_type(x) == LVAL_SEXPR) {
+			open = lgrow(open, &cap, count, sizeof(lwalk));
+			open[count++] = (lwalk) { x, lvm_is_linked_call(x) };
+		} else if (!laot_value(x)) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-	  "Function 'eval' not passed a Q-expression");
-	  
-	lval* x = lval_take(a, 0);
-	x->type = LVAL_SEXPR;
-	return lval_eval(x);
+// The next line of f, without its newline, or NULL at the end of f
+char* lread_line(FILE* f) {
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t n = getline(&line, &cap, f);
+	if (n < 0) {
+		free(line);
+		return NULL;
+	}
+	if (n > 0 && line[n - 1] == '\n') { line[n - 1] = '\0'; }
+	return line;
 }
 
-lval* lval_join(lval* x, lval* y) {
+// Translate the program at path to C, written to out. Returns false if it
+// has something that cannot be compiled. Each line gets functions of its
+// own, so they stay small however long the program is.
+bool laot_compile(FILE* out, char* path, mpc_parser_t* parser, bool fold) {
+	FILE* in = fopen(path, "r");
+	if (in == NULL) {
+		fprintf(stderr, "prompt: cannot open %s\n", path);
+		return false;
+	}
+	
+	fputs("// Generated by prompt --aot from ", out);
+	laot_string(out, path);
+	fputs("; do not edit\n\n", out);
+	fputs("#define LAOT\n#include \"prompt.c\"\n\n", out);
+	laot.const_count = 0;
+	
+	// The table of lines, built up as they are compiled
+	char* table;
+	size_t table_size;
+	FILE* table_out = open_memstream(&table, &table_size);
 	
-	// Add each element of y to x
-	while (y->count) {
-		x = lval_add(x, lval_pop(y, 0));
+	bool ok = true;
+	int count = 0;
+	char* input;
+	while (ok && (input = lread_line(in)) != NULL) {
+		count++;
+		mpc_result_t r;
+		if (!mpc_parse(path, input, parser, &r)) {
+			char* error = mpc_err_string(r.error);
+			fputs("\t{ NULL, NULL, ", table_out);
+			laot_string(table_out, error);
+			fputs(" },\n", table_out);
+			free(error);
+			mpc_err_delete(r.error);
+			free(input);
+			continue;
+		}
+		
+		// The line is read as the interpreter would read it, and then
+		// dropped like the rest of what this makes: nothing is collected
+		// while compiling, so none of it needs rooting
+		lval* l = lval_read(r.output);
+		int folded = 0;
+		if (fold) { l = lfold(l, &folded); }
+		mpc_ast_delete(r.output);
+		free(input);
+		
+		char* consts;
+		char* code;
+		size_t consts_size;
+		size_t code_size;
+		laot.consts_out = open_memstream(&consts, &consts_size);
+		laot.code_out = open_memstream(&code, &code_size);
+		int first_const = laot.const_count;
+		laot.cache_count = 0;
+		laot.depth = 0;
+		laot.max_depth = 0;
+		laot.jumps = false;
+		ok = lval_type(l) == LVAL_SEXPR ? laot_sexpr(l) : laot_value(l);
+		fclose(laot.consts_out);
+		fclose(laot.code_out);
+		
+		bool has_consts = laot.const_count > first_const;
+		if (has_consts) { fprintf(out, "static void laot_consts_%d(void) {\n%s}\n\n", count, consts); }
+		fprintf(out, "static lval* laot_line_%d(void) {\n", count);
+		if (laot.cache_count) { fprintf(out, "\tstatic lcache caches[%d];\n", laot.cache_count); }
+		fprintf(out, "\tint entry = lvm.stack.count;\n");
+		fprintf(out, "\tlval* r;\n");
+		fprintf(out, "\tlval_stack_reserve(&lvm.stack, %d);\n", laot.max_depth);
+		fputs(code, out);
+		fprintf(out, "\tr = LAOT_TOP(1);\n");
+		if (laot.jumps) { fprintf(out, "done:\n"); }
+		fprintf(out, "\tlvm.stack.count = entry;\n");
+		fprintf(out, "\treturn r;\n");
+		fprintf(out, "}\n\n");
+		free(consts);
+		free(code);
+		
+		if (has_consts) {
+			fprintf(table_out, "\t{ laot_consts_%d, laot_line_%d, NULL },\n", count, count);
+		} else {
+			fprintf(table_out, "\t{ NULL, laot_line_%d, NULL },\n", count);
+		}
 	}
+	fclose(in);
+	fclose(table_out);
 	
-	lval_del(y);
-	return x;
+	if (!ok) {
+		fprintf(stderr, "prompt: %s:%d: cannot be compiled ahead of time\n", path, count);
+	} else {
+		fprintf(out, "static laot_line laot_lines[%d] = {\n%s};\n\n", count + 1, table);
+		fputs("int main(int argc, char** argv) {\n", out);
+		fprintf(out, "\treturn laot_main(argc, argv, (laot_program) { %d, laot_lines, %d });\n",
+		        laot.const_count, count);
+		fputs("}\n", out);
+	}
+	free(table);
+	return ok;
 }
 
-lval* builtin_join(lval* a) {
-	for (int i = 0; i < a->count; i++) {
-		LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
-		  "Function 'join' passed incorrect type.");
+// The main of a program compiled ahead of time: run its lines in order,
+// printing their results as the interpreter does when given a file
+int laot_main(int argc, char** argv, laot_program p) {
+	bool timing = false;
+	lvm.max_depth = LVM_MAX_DEPTH;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--time") == 0) { timing = true; }
+		if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) { lvm.max_depth = atoi(argv[++i]); }
+		if (strcmp(argv[i], "--gc-stress") == 0) { lgc.stress = true; }
 	}
 	
-	lval* x = lval_pop(a, 0);
+	lsetup();
+	double start = now_ms();
+	lgc_root_stack(&laot.consts);
+	lval_stack_reserve(&laot.consts, p.const_count);
+	laot.consts.count = p.const_count;
+	for (int i = 0; i < p.count; i++) {
+		if (p.lines[i].consts) { p.lines[i].consts(); }
+	}
 	
-	while (a->count) {
-		x = lval_join(x, lval_pop(a, 0));
+	for (int i = 0; i < p.count; i++) {
+		if (p.lines[i].run == NULL) {
+			fputs(p.lines[i].error, stdout);
+			continue;
+		}
+		lmem_line_begin();
+		lval* x = p.lines[i].run();
+		lgc_root(&x);
+		lgc_line_end();
+		lval_println(x);
+		lgc_unroot(1);
 	}
 	
-	lval_del(a);
-	return x;
+	if (timing) { fprintf(stderr, ";; total %.3f ms\n", now_ms() - start); }
+	return 0;
 }
 
-lval* builtin_op(lval* a, char* op) {
-	
-	// Check to make sure we're operating on numbers
-	for (int i = 0; i < a->count; i++) {
-		int type = a->cell[i]->type;
-		if ((type != LVAL_INT) && (type != LVAL_FLOAT))  {
-			lval_del(a);
-			return lval_err("Cannot operate on non-number!");
-		}
+// Find a builtin by comparing its name with each builtin's in turn
+lval* lbench_scan(char* name) {
+	for (int i = 0; i < LBUILTIN_SLOTS; i++) {
+		if (lbuiltin_table[i].name && strcmp(lbuiltin_table[i].name, name) == 0) { return &lbuiltins[i]; }
 	}
+	return NULL;
+}
+
+// Microbenchmark of getting from a call to its builtin, run with
+// --bench-dispatch. "strcmp" looks the name up on every call by comparing
+// it with each builtin's, as dispatching by name does; "hash" looks it up
+// in the perfect hash on every call; "linked" calls the builtin the
+// reader already put in the tree. Each call is a two-argument arithmetic
+// builtin, whose own cost is in all three.
+void lbench_dispatch(void) {
+	char* names[] = { "+", "-", "*", "max", "min" };
+	lval* linked[5];
+	for (int i = 0; i < 5; i++) { linked[i] = lbuiltin_find(names[i]); }
 	
-	lval* x = lval_pop(a, 0);
-	bool is_float = false;
+	lval* args[2] = { lval_int(3), lval_int(4) };
+	long calls = 10000000;
+	long sum = 0;
 	
-	if (x->type == LVAL_FLOAT) {
-		is_float = true;
+	double start = now_ms();
+	for (long i = 0; i < calls; i++) {
+		lval* f = lbench_scan(names[i % 5]);
+		sum += lval_get_int(f->fn(args, 2));
+	}
+	double scan = now_ms();
+	for (long i = 0; i < calls; i++) {
+		lval* f = lbuiltin_find(names[i % 5]);
+		sum += lval_get_int(f->fn(args, 2));
+	}
+	double hash = now_ms();
+	for (long i = 0; i < calls; i++) {
+		lval* f = linked[i % 5];
+		sum += lval_get_int(f->fn(args, 2));
 	}
+	double end = now_ms();
 	
-	if ((strcmp(op, "-") == 0) && a->count == 0) {
-		if (is_float) {
-			x->f = -x->f;
+	printf("strcmp  %6.2f ns/call\n", (scan - start) * 1e6 / calls);
+	printf("hash    %6.2f ns/call\n", (hash - scan) * 1e6 / calls);
+	printf("linked  %6.2f ns/call\n", (end - hash) * 1e6 / calls);
+	printf("(checksum %li)\n", sum);
+}
+
+// Microbenchmark of looking up globals, run with --bench-env. Each
+// size defines globals up to that many, then looks up 1024 sites, each
+// naming one of them at random: "hash" goes through the table every
+// time, "cached" through an lcache per site, and "scan" compares with
+// every name in turn, as an environment kept in a list would.
+void lbench_env(void) {
+	int sites = 1024;
+	lval* names[1024];
+	lcache caches[1024];
+	long lookups = 10000000;
+	long sum = 0;
+	
+	int max = 1 << 20;
+	lval** defined = malloc(sizeof(lval*) * max);
+	int count = 0;
+	unsigned int seed = 1;
+	
+	printf("globals    hash  cached    scan (ns/lookup)\n");
+	for (int size = 16; size <= max; size *= 16) {
+		char name[32];
+		for (; count < size; count++) {
+			snprintf(name, sizeof(name), "g%d", count);
+			defined[count] = lval_sym(name);
+			lenv_put(defined[count], lval_int(count));
+			lgc_safepoint();
 		}
-		else {
-			x->i = -x->i;
+		for (int i = 0; i < sites; i++) {
+			seed = seed * 1103515245u + 12345u;
+			names[i] = defined[(seed >> 8) % size];
+			caches[i] = (lcache) { 0, NULL };
 		}
-	}
-	
-	while (a->count > 0) {
 		
-		lval* y = lval_pop(a, 0);
-		
-		if (y->type == LVAL_FLOAT && !is_float) {
-			is_float = true;
-			x = lval_float((float) x->i);
+		double start = now_ms();
+		for (long i = 0; i < lookups; i++) {
+			sum += lval_get_int(lenv_get(names[i & (sites - 1)]));
+		}
+		double hash = now_ms();
+		for (long i = 0; i < lookups; i++) {
+			int site = i & (sites - 1);
+			sum += lval_get_int(lenv_cached(&caches[site], names[site]));
 		}
+		double cached = now_ms();
 		
-		if (is_float) {
-			
-			if (y->type == LVAL_INT) {
-				y = lval_float((float) y->i);
-			}
-			
-			if (strcmp(op, "+") == 0) { x->f += y->f; }
-			if (strcmp(op, "-") == 0) { x->f -= y->f; }
-			if (strcmp(op, "*") == 0) { x->f *= y->f; }
-			if (strcmp(op, "/") == 0) {
-				if (y->f == 0) {
-					return lval_err("Division by zero!");
-				} 
-				else {
-					x->f /= y->f; 
-				}
+		// Scanning the big tables would take minutes, so it does fewer
+		long scans = size <= 4096 ? lookups / size * 16 : 0;
+		for (long i = 0; i < scans; i++) {
+			lval* sym = names[i & (sites - 1)];
+			for (int j = 0; j < size; j++) {
+				if (defined[j] == sym) { sum += j; break; }
 			}
+		}
+		double end = now_ms();
 		
-		if (strcmp(op, "max") == 0) {
-			if (x->f < y->f) {
-				x->f = y->f;
-			}
+		printf("%7d %7.2f %7.2f ", size, (hash - start) * 1e6 / lookups, (cached - hash) * 1e6 / lookups);
+		if (scans) {
+			printf("%7.2f\n", (end - cached) * 1e6 / scans);
+		} else {
+			printf("      -\n");
 		}
-		if (strcmp(op, "min") == 0) {
-			if (x->f > y->f) {
-				x->f = y->f;
+	}
+	printf("(checksum %li)\n", sum);
+	free(defined);
+}
+
+// A chain of "terms" calls, each (op a (op b c)) on the variables x and
+// y, summed up by one +
+lval* lbench_chain(int terms) {
+	char* ops[] = { "+", "-", "*", "max", "min" };
+	lval* vars[] = { lval_sym("x"), lval_sym("y") };
+	lval* chain = lval_list(LVAL_SEXPR, terms + 1);
+	chain = lval_add(chain, lbuiltin_find("+"));
+	for (int i = 0; i < terms; i++) {
+		lval* inner = lval_list(LVAL_SEXPR, 3);
+		inner = lval_add(inner, lbuiltin_find(ops[(i + 1) % 5]));
+		inner = lval_add(inner, vars[i % 2]);
+		inner = lval_add(inner, lval_int(i % 7 + 1));
+		lval* term = lval_list(LVAL_SEXPR, 3);
+		term = lval_add(term, lbuiltin_find(ops[i % 5]));
+		term = lval_add(term, vars[(i + 1) % 2]);
+		chain = lval_add(chain, lval_add(term, inner));
+	}
+	return chain;
+}
+
+// Microbenchmark of the JIT, run with --bench-jit. A long arithmetic
+// chain is compiled into one chunk, which is run over and over by the
+// VM with the JIT off and then on, with x and y integers and then
+// doubles.
+void lbench_jit(void) {
+	lval* chain = lbench_chain(200);
+	int ops = 200 * 2 + 1;
+	lgc_root(&chain);
+	// Chunks keep their constants unrooted, so they must stay put
+	lgc_minor();
+	
+	long runs = 200000;
+	double sum = 0;
+	printf("types    interp      jit (ns/run)  interp      jit (Mops/s)\n");
+	for (int floats = 0; floats < 2; floats++) {
+		lenv_put(lval_sym("x"), floats ? lval_float(3.5) : lval_int(3));
+		lenv_put(lval_sym("y"), floats ? lval_float(-1.25) : lval_int(-2));
+		
+		double ns[2];
+		for (int jit = 0; jit < 2; jit++) {
+			lvm.jit = jit;
+			lchunk* c = lchunk_new();
+			lvm_compile(c, chain);
+			lchunk_op(c, LOP_RETURN);
+			// Long enough for the site to get hot and the collector to
+			// settle into its pace
+			for (long i = 0; i < runs / 4; i++) {
+				lvm_exec(c);
+				lgc_safepoint();
 			}
-		}
 			
-		} 
-		// Integer operations
-		else {
-			if (strcmp(op, "+") == 0) { x->i += y->i; }
-			if (strcmp(op, "-") == 0) { x->i -= y->i; }
-			if (strcmp(op, "*") == 0) { x->i *= y->i; }
-			if (strcmp(op, "%") == 0) { x->i %= y->i; }
-			if (strcmp(op, "/") == 0) {
-				if (y->i == 0) {
-					return lval_err("Division by zero!");
-				}
-				else if (x->i % y->i == 0) {
-					x->i /= y->i;
-				}
-				else {
-					x = lval_float((float)x->i / (float)y->i);
-				}
-			}
-			if (strcmp(op, "max") == 0) {
-				if (x->i < y->i) {
-					x->i = y->i;
-				}
-			}
-			if (strcmp(op, "min") == 0) {
-				if (x->i > y->i) {
-					x->i = y->i;
-				}
+			double start = now_ms();
+			for (long i = 0; i < runs; i++) {
+				sum += lval_get_num(lvm_exec(c));
+				lgc_safepoint();
 			}
+			ns[jit] = (now_ms() - start) * 1e6 / runs;
+			lchunk_done();
+		}
+		printf("%-6s %8.1f %8.1f             %8.1f %8.1f\n", floats ? "float" : "int",
+		       ns[0], ns[1], ops / ns[0] * 1e3, ops / ns[1] * 1e3);
+	}
+	printf("(%d sites compiled, checksum %g)\n", ljit_perf.compiled, sum);
+	lvm.jit = false;
+	lgc_unroot(1);
+}
+
+// {+ {+ (* x x) (- x 1) (len (tail l)) ...} {+ (* y 1.0) (/ y 2.0) ...}}
+// for lbench_quick, with fresh calls
+lval* lbench_quick_expr(int terms) {
+	lval* x = lval_sym("x");
+	lval* y = lval_sym("y");
+	lval* ints = lval_list(LVAL_SEXPR, terms + 1);
+	lval* floats = lval_list(LVAL_SEXPR, terms + 1);
+	ints = lval_add(ints, lbuiltin_find("+"));
+	floats = lval_add(floats, lbuiltin_find("+"));
+	for (int i = 0; i < terms; i++) {
+		lval* t = lval_list(LVAL_SEXPR, 3);
+		t = lval_add(t, lbuiltin_find(i % 3 == 0 ? "*" : "-"));
+		t = lval_add(t, x);
+		ints = lval_add(ints, lval_add(t, i % 2 ? x : lval_int(1)));
+		lval* u = lval_list(LVAL_SEXPR, 3);
+		u = lval_add(u, lbuiltin_find(i % 3 == 0 ? "*" : "/"));
+		u = lval_add(u, y);
+		floats = lval_add(floats, lval_add(u, lval_float(i + 1)));
+		if (i % 5 == 0) {
+			lval* tail = lval_list(LVAL_SEXPR, 2);
+			tail = lval_add(tail, lbuiltin_find("tail"));
+			tail = lval_add(tail, lval_sym("l"));
+			lval* len = lval_list(LVAL_SEXPR, 2);
+			len = lval_add(len, lbuiltin_find("len"));
+			ints = lval_add(ints, lval_add(len, tail));
 		}
-		lval_del(y);
 	}
+	lval* q = lval_list(LVAL_QEXPR, 3);
+	q = lval_add(q, lbuiltin_find("+"));
+	q = lval_add(q, ints);
+	return lval_add(q, floats);
+}
+
+// Microbenchmark of quickening, run with --bench-quick: each evaluator
+// evaluates the same stored Q-expression over and over, as eval does,
+// with its calls left as the reader linked them and then quickened
+void lbench_quick(void) {
+	lval* list = lval_list(LVAL_QEXPR, 8);
+	for (int i = 0; i < 8; i++) { list = lval_add(list, lval_int(i)); }
+	lenv_put(lval_sym("l"), list);
+	lenv_put(lval_sym("x"), lval_int(6));
+	lenv_put(lval_sym("y"), lval_float(0.5));
 	
-	lval_del(a);
-	return x;
+	long runs = 20000;
+	double sum = 0;
+	printf("evaluator  generic   quick (us/eval)\n");
+	for (int tree = 0; tree < 2; tree++) {
+		double us[2];
+		for (int quick = 0; quick < 2; quick++) {
+			lquick.off = !quick;
+			lval* q = lbench_quick_expr(50);
+			lgc_root(&q);
+			double start = now_ms();
+			for (long i = 0; i < runs; i++) {
+				sum += lval_get_num(tree ? lval_eval_sexpr(q) : lvm_eval_sexpr(q));
+				lgc_safepoint();
+			}
+			us[quick] = (now_ms() - start) * 1e3 / runs;
+			lgc_unroot(1);
+		}
+		printf("%-9s %8.2f %8.2f\n", tree ? "tree" : "vm", us[0], us[1]);
+	}
+	lquick.off = false;
+	printf("(checksum %g)\n", sum);
 }
 
+// One element for lbench_mem, a fresh copy of the kind numbered k. Lists
+// are sized up front, as the reader sizes them.
+lval* lbench_mem_element(int k) {
+	switch (k) {
+		case 0: return lval_int(7);
+		case 1: return lval_float(1.5);
+		case 2: return lval_int(1L << 60);
+		case 3: return lbuiltin_find("head");
+		case 4: return lval_sym("x");
+		case 5: return lval_err("x");
+		case 6: return lval_add(lval_add(lval_list(LVAL_QEXPR, 2), lval_int(1)), lval_int(2));
+	}
+	lval* v = lval_add(lval_list(LVAL_SEXPR, 3), lbuiltin_find("+"));
+	return lval_add(lval_add(v, lval_int(1)), lval_int(2));
+}
 
-lval* builtin(lval* a, char* func) {
-	if (strcmp("list", func) == 0) { return builtin_list(a); }
-	if (strcmp("head", func) == 0) { return builtin_head(a); }
-	if (strcmp("tail", func) == 0) { return builtin_tail(a); }
-	if (strcmp("join", func) == 0) { return builtin_join(a); }
-	if (strcmp("eval", func) == 0) { return builtin_eval(a); }
-	if (strcmp("len", func) == 0) { return builtin_len(a); }
-	if (strcmp("cons", func) == 0) { return builtin_cons(a); }
-	if (strstr("+-/*% max min", func)) { return builtin_op(a, func); }
-	lval_del(a);
-	return lval_err("Unknown function");
+// Memory per element, run with --bench-mem: the old generation's growth
+// once a Q-expression of 10^6 fresh copies of each kind of element has
+// been promoted, divided by the count. The Q-expression's own cells are
+// part of it, one word per element.
+void lbench_mem(void) {
+	char* names[] = { "7", "1.5", "2^60", "head", "x", "error", "{1 2}", "(+ 1 2)" };
+	int n = 1000000;
+	printf("lval header %zu bytes\n", sizeof(lval));
+	printf("element     bytes/element\n");
+	for (int k = 0; k < 8; k++) {
+		// Start from an empty old generation, with no major collection
+		// under way to free anything during the count
+		lgc_line_end();
+		while (lgc.phase != LGC_IDLE) { lgc_line_end(); }
+		size_t before = lmem.old_bytes;
+		
+		lval* q = lval_list(LVAL_QEXPR, n);
+		lgc_root(&q);
+		for (int i = 0; i < n; i++) { q = lval_add(q, lbench_mem_element(k)); }
+		lgc_minor();
+		printf("%-10s %8.2f\n", names[k], (double) (lmem.old_bytes - before) / n);
+		lgc_unroot(1);
+	}
 }
 
-lval* lval_eval(lval* v);
+// A lambda of one formal and a body of a builtin call on the formal
+// and one more value, for lbench_par
+lval* lbench_lambda(char* name, char* formal, lval* other) {
+	lval* formals = lval_add(lval_qexpr(), lval_sym(formal));
+	lval* body = lval_add(lval_qexpr(), lbuiltin_find(name));
+	body = lval_add(lval_add(body, lval_sym(formal)), other);
+	return lval_lambda(formals, body, -1);
+}
 
-lval* lval_eval_sexpr(lval* v) {
+// Scaling of the parallel builtins, run with --bench-par: pmap, pfilter
+// and preduce over a list of 10^7 integers on 1, 2, 4 and so on up to
+// the --parallel threads, by default one per processor
+void lbench_par(int threads) {
+	int n = 10000000;
+	lval* q = lval_list(LVAL_QEXPR, n);
+	for (int i = 0; i < n; i++) { q->cell[i] = lval_int(i % 1000); }
+	q->count = n;
+	if (q->cells) { q->cells->end = n; }
+	lgc_write(q, 0, n);
+	lgc_root(&q);
 	
-	// Evaluate children
-	for (int i = 0; i < v-> count; i++) {
-		v->cell[i] = lval_eval(v->cell[i]);
-	}
+	// A square, an odd test, and +, which preduce sums as a tree
+	lval* args[3][2] = {
+		{ lbench_lambda("*", "x", lval_sym("x")), q },
+		{ lbench_lambda("%", "x", lval_int(2)), q },
+		{ lbuiltin_find("+"), q },
+	};
+	lbuiltin fns[3] = { builtin_pmap, builtin_pfilter, builtin_preduce };
+	lgc_root(&args[0][0]);
+	lgc_root(&args[1][0]);
 	
-	// Error checking
-	for (int i = 0; i < v->count; i++) {
-		lval* x = v->cell[i];
-		int type = x->type;
-		if (type == LVAL_ERR) {
-			return lval_take(v, i);
+	double base[3];
+	double sum = 0;
+	printf("threads     pmap  pfilter  preduce (ms)  speedup\n");
+	for (int t = 1; ; t = t * 2 < threads ? t * 2 : threads) {
+		if (lpar_start(t) < t) {
+			printf("(could not start %d threads)\n", t);
+			break;
 		}
+		double ms[3];
+		for (int op = 0; op < 3; op++) {
+			args[op][1] = q;
+			double start = now_ms();
+			lval* r = fns[op](args[op], 2);
+			ms[op] = now_ms() - start;
+			sum += lval_type(r) == LVAL_QEXPR ? r->count : lval_get_num(r);
+			lgc_safepoint();
+			if (t == 1) { base[op] = ms[op]; }
+		}
+		printf("%7d %8.1f %8.1f %8.1f   %5.2f %5.2f %5.2f\n", t, ms[0], ms[1], ms[2],
+		       base[0] / ms[0], base[1] / ms[1], base[2] / ms[2]);
+		if (t >= threads) { break; }
 	}
+	printf("(checksum %g)\n", sum);
+	lgc_unroot(3);
+}
+
+// Code compiled ahead of time has a main of its own
+#ifndef LAOT
+int main(int argc, char** argv) {
 	
-	// Empty expression
-	if (v->count == 0 ) { return v; }
+	char* path = NULL;
+	bool aot = false;
+	bool alloc_stats = false;
+	bool timing = false;
+	bool bench_dispatch = false;
+	bool bench_env = false;
+	bool bench_jit = false;
+	bool bench_quick = false;
+	bool bench_mem = false;
+	bool bench_par = false;
+	bool fold = true;
+	int threads = 0;
+	lvm.max_depth = LVM_MAX_DEPTH;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--alloc-stats") == 0) { alloc_stats = true; }
+		if (strcmp(argv[i], "--time") == 0) { timing = true; }
+		// Evaluate the tree directly, to check the VM against
+		if (strcmp(argv[i], "--tree-eval") == 0) { lvm.reference = true; }
+		if (strcmp(argv[i], "--bench-dispatch") == 0) { bench_dispatch = true; }
+		if (strcmp(argv[i], "--bench-env") == 0) { bench_env = true; }
+		if (strcmp(argv[i], "--bench-jit") == 0) { bench_jit = true; }
+		if (strcmp(argv[i], "--bench-quick") == 0) { bench_quick = true; }
+		if (strcmp(argv[i], "--bench-mem") == 0) { bench_mem = true; }
+		if (strcmp(argv[i], "--bench-par") == 0) { bench_par = true; }
+		// Leave calls as the reader linked them
+		if (strcmp(argv[i], "--no-quicken") == 0) { lquick.off = true; }
+		// Compile hot arithmetic to native code, where there is a JIT
+		if (strcmp(argv[i], "--jit") == 0) { lvm.jit = true; }
+		// Evaluate lines as they are read, without folding constants
+		if (strcmp(argv[i], "--no-fold") == 0) { fold = false; }
+		// How deeply evaluations can nest before stopping with an error
+		if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+			lvm.max_depth = atoi(argv[++i]);
+			continue;
+		}
+		// Collect at every safepoint, which is slow but finds lvals the
+		// collector was not told about
+		if (strcmp(argv[i], "--gc-stress") == 0) { lgc.stress = true; }
+		// Share Q-expressions read with the same structure
+		if (strcmp(argv[i], "--hash-cons") == 0) { lhcons.on = true; }
+		// Keep the values of pure S-expressions, up to a budget in bytes
+		if (strcmp(argv[i], "--memo") == 0) { lmemo.on = lhcons.on = true; }
+		if (strcmp(argv[i], "--memo-budget") == 0 && i + 1 < argc) {
+			lmemo.on = lhcons.on = true;
+			lmemo.budget = strtoul(argv[++i], NULL, 10);
+			continue;
+		}
+		// Evaluate pure items on this many threads. Folding would do
+		// their work before the evaluator could share it out, and saves
+		// nothing else, as a line is evaluated once.
+		if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			fold = false;
+			continue;
+		}
+		// How many steps a green thread runs for before the next has a turn
+		if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+			lgreen.slice = atoi(argv[++i]);
+			if (lgreen.slice < 1) { lgreen.slice = 1; }
+			continue;
+		}
+		// Translate the file to C rather than running it
+		if (strcmp(argv[i], "--aot") == 0) { aot = true; }
+		// Run the lines of a file, printing only their results
+		if (argv[i][0] != '-') { path = argv[i]; }
+	}
 	
-	// Single expression
-	if (v-> count == 1) { return lval_take(v, 0); }
+	lsetup();
 	
-	// Ensure first element is a symbol
-	lval* first = lval_pop(v, 0);
-	if (first->type != LVAL_SYM) {
-		lval_del(first); 
-		lval_del(v);
-		return lval_err("S-expression does not start with a symbol!");
+	if (bench_par) {
+		lbench_par(threads ? threads : sysconf(_SC_NPROCESSORS_ONLN));
+		return 0;
+	}
+	if (threads) {
+		int started = lpar_start(threads);
+		if (started < threads) {
+			fprintf(stderr, "prompt: --parallel %d could only start %d threads\n", threads, started);
+		}
+		lvm.parallel = true;
 	}
 	
-	// Call builtin with operator
-	lval* result = builtin(v, first->sym);
-	lval_del(first);
-	return result;
-}
-
-lval* lval_eval(lval* v) {
-	// Evaluate S-expressions
-	if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(v); }
-	// Return anything that isn't a S-expression
-	return v;
-}
-
-int main(int argc, char** argv) {
+	if (bench_dispatch) {
+		lbench_dispatch();
+		return 0;
+	}
+	if (bench_env) {
+		lbench_env();
+		return 0;
+	}
+	if (bench_jit) {
+		lbench_jit();
+		return 0;
+	}
+	if (bench_quick) {
+		lbench_quick();
+		return 0;
+	}
+	if (bench_mem) {
+		lbench_mem();
+		return 0;
+	}
 	
-	/* Create parsers */
-	mpc_parser_t* Integer = mpc_new("integer");
-	mpc_parser_t* Float = mpc_new("float");
-	mpc_parser_t* Symbol = mpc_new("symbol");
-	mpc_parser_t* Sexpr = mpc_new("sexpr");
-	mpc_parser_t* Qexpr = mpc_new("qexpr");
-	mpc_parser_t* Expr = mpc_new("expr");
-	mpc_parser_t* Bilisp = mpc_new("bilisp");
-
-	mpca_lang(MPCA_LANG_DEFAULT,
-  	" \
-			integer	 : /-?[0-9]+/ ;	\
-			float    : <integer> '.'<integer>;	\
-  		symbol   : '+' \
-  						 | '-' \
-  						 | '*' \
-  						 | '/' \
-  						 | '^' \
-  						 | '%' \
-  						 | \"max\" \
-  						 | \"min\" \
-  						 | \"list\" \
-  						 | \"head\" \
-  						 | \"tail\" \
-  						 | \"join\" \
-  						 | \"len\" \
-  						 | \"cons\" \
-  						 | \"eval\" ; \
-  		sexpr    : '(' <expr>* ')' ; \
-  		qexpr    : '{' <expr>* '}' ; \
-  		expr     : <float> \
-  						 | <integer> \
-  						 | <symbol> \
-  						 | <qexpr> \
-  						 | <sexpr> ; \
-  		bilisp   : /^/ <expr>* /$/ ; \
-  	",
-  	Integer, Float, Symbol, Sexpr, Qexpr, Expr, Bilisp);
+	if (aot) {
+		bool ok = path && laot_compile(stdout, path, lgrammar.bilisp, fold);
+		if (!path) { fprintf(stderr, "prompt: --aot needs a file to compile\n"); }
+		lgrammar_free();
+		return ok ? 0 : 1;
+	}
 	
-	puts("Bilisp 0.0.0.0.1");
-	puts("Press Ctrl+c to Exit\n");
+	FILE* in = NULL;
+	if (path) {
+		in = fopen(path, "r");
+		if (in == NULL) {
+			fprintf(stderr, "prompt: cannot open %s\n", path);
+			return 1;
+		}
+	} else {
+		puts("Bilisp 0.0.0.0.1");
+		puts("Press Ctrl+c to Exit\n");
+	}
+	double run_start = now_ms();
 	
 	while (1) {
 		
-		char* input = readline("bilisp> ");
+		char* input = in ? lread_line(in) : readline("bilisp> ");
+		if (input == NULL) { break; }
 		
-		add_history(input);
+		if (!in) { add_history(input); }
 		
 		/* Attempt to parse the user input */
 		mpc_result_t r;
-		if (mpc_parse("<stdin>", input, Bilisp, &r)) {
+		if (mpc_parse(in ? path : "<stdin>", input, lgrammar.bilisp, &r)) {
 			mpc_ast_t* ast = r.output;
 			
 //			mpc_ast_print(ast);
 			
+			lmem_line_begin();
+			
+			double start = now_ms();
 			lval* l = lval_read(ast);
+			double read = now_ms();
+			
+			int folded = 0;
+			if (fold) { l = lfold(l, &folded); }
+			double folding = now_ms();
 			
 //			lval_println(l);
 			
-			lval* x = lval_eval(l);
+			lchunk* c = NULL;
+			if (!lvm.reference) {
+				c = lchunk_new();
+				lvm_compile(c, l);
+			}
+			double compile = now_ms();
+			
+			lval* x = c ? lvm_run(c) : lval_eval(l);
+			double eval = now_ms();
+			
+			// The result is the only root left, so everything else the
+			// line made in the nursery is dropped here
+			lgc_root(&x);
+			lgc_line_end();
+			
 			lval_println(x);
+			if (alloc_stats) { lmem_print_stats(); }
+			if (alloc_stats && lhcons.on) { lhcons_print_stats(); }
+			if (alloc_stats && lmemo.on) { lmemo_print_stats(); }
+			if (alloc_stats && lpar.workers) { lpar_print_stats(); }
+			if (alloc_stats && lgreen.spawned) { lgreen_print_stats(); }
+			if (alloc_stats && lvm.jit) { ljit_print_stats(); }
+			if (timing) {
+				printf(";; read %.3f ms, fold %.3f ms (%d folded), compile %.3f ms, eval %.3f ms\n",
+				       read - start, folding - read, folded, compile - folding, eval - compile);
+			}
 			
-			lval_del(x);
+			lgc_unroot(1);
 
 			mpc_ast_delete(ast);
 			
@@ -554,8 +7681,14 @@ int main(int argc, char** argv) {
 		
 	}
 	
+	if (in) {
+		fclose(in);
+		if (timing) { fprintf(stderr, ";; total %.3f ms\n", now_ms() - run_start); }
+	}
+	
 	/* Undefine and delete parsers */
-	mpc_cleanup(7, Integer, Float, Symbol, Sexpr, Qexpr, Expr, Bilisp);
+	lgrammar_free();
 	
 	return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file